@@ -0,0 +1,82 @@
+#include "solver_common.hpp"
+
+// hide includes form user
+#include "../externals/kissat.h" // https://github.com/arminbiere/kissat
+
+using namespace std;
+
+/****************************/
+// MARK: constructor
+/****************************/
+
+/** Constructor of _MAPFSAT_Kissat.
+*
+* The formula is created as for CaDiCaL and solved by Kissat. Kissat solves a formula only once, therefore only eager encodings are supported and the formula is rebuilt for each delta.
+*
+* @param var variables to be use. Possible values 1 = at, 2 = pass, 3 = shift.
+* @param cost optimized cost function. Possible values 1 = mks, 2 = soc.
+* @param moves allowed movement. Possible values 1 = parallel, 2 = pebble.
+* @param lazy eager or lazy solving of conflicts. Only 1 = eager is possible.
+* @param dupli allow of forbid duplicating agents. Possible values 1 = forbid, 2 = allow.
+* @param solver SAT solver to be used. Only 3 = Kissat is possible.
+* @param sol_name name of the encoding used in log. Defualt value is Kissat_encoding.
+*/
+_MAPFSAT_Kissat::_MAPFSAT_Kissat(int var, int cost, int moves, int lazy, int dupli, int solver, string sol_name)
+	: _MAPFSAT_SAT(var, cost, moves, lazy, dupli, solver, sol_name)
+{
+	assert(lazy_const == 1);
+	assert(solver_to_use == 3);
+};
+
+_MAPFSAT_ISolver* _MAPFSAT_Kissat::NewSolver()
+{
+	return new _MAPFSAT_Kissat(variables, cost_function, movement, lazy_const, duplicates, solver_to_use, solver_name);
+}
+
+/****************************/
+// MARK: aux
+/****************************/
+
+void _MAPFSAT_Kissat::AddLiteral(int lit)
+{
+	kissat_add((kissat*)SAT_solver, lit);
+
+	if (cnf_writer.IsOpen())
+		cnf_writer.AddLiteral(lit);
+	if (binary_writer.IsOpen())
+		binary_writer.AddLiteral(lit, clause_family);
+}
+
+void _MAPFSAT_Kissat::CreateSolver()
+{
+	SAT_solver = kissat_init();
+}
+
+void _MAPFSAT_Kissat::ReleaseSolver()
+{
+	if (SAT_solver != NULL)
+		kissat_release((kissat*)SAT_solver);
+	SAT_solver = NULL;
+}
+
+int _MAPFSAT_Kissat::InvokeSolverImplementation()
+{
+	kissat_set_terminate((kissat*)SAT_solver, &deadline, Terminate);	// polled by Kissat during the search
+
+	int ret = kissat_solve((kissat*)SAT_solver); // 20 = UNSAT; 10 = SAT; 0 = UNKNOWN (reached through terminate)
+
+	if ((print_plan || keep_plan) && ret == 10)	// create plan from variables
+		CreatePlan();
+
+	return (ret == 10) ? 0 : 1;
+}
+
+int _MAPFSAT_Kissat::Value(int var)
+{
+	return kissat_value((kissat*)SAT_solver, var);
+}
+
+int _MAPFSAT_Kissat::Terminate(void* state)
+{
+	return ((const _MAPFSAT_Deadline*)state)->Expired() ? 1 : 0;
+}
@@ -1,10 +1,25 @@
 #include "solver_common.hpp"
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
 // hide includes form user
 #include "../externals/cadical.hpp" // https://github.com/arminbiere/cadical
 
 using namespace std;
 
+// polled by CaDiCaL during the search, stops it once the deadline expires
+class _MAPFSAT_CaDiCaLTerminator : public CaDiCaL::Terminator
+{
+public:
+	_MAPFSAT_CaDiCaLTerminator(const _MAPFSAT_Deadline& d) : deadline(d) {}
+	bool terminate() { return deadline.Expired(); }
+
+private:
+	const _MAPFSAT_Deadline& deadline;
+};
+
 /****************************/
 // MARK: constructor
 /****************************/
@@ -16,7 +31,7 @@ using namespace std;
 * @param moves allowed movement. Possible values 1 = parallel, 2 = pebble.
 * @param lazy eager or lazy solving of conflicts. Possible values 1 = eager, 2 = lazy.
 * @param dupli allow of forbid duplicating agents. Possible values 1 = forbid, 2 = allow.
-* @param solver SAT solver to be used. Possible values 1 = CaDiCaL, 2 = monosat.
+* @param solver SAT solver to be used. Possible values 1 = CaDiCaL, 3 = Kissat.
 * @param sol_name name of the encoding used in log. Defualt value is at_parallel_mks_all.
 */
 _MAPFSAT_SAT::_MAPFSAT_SAT(int var, int cost, int moves, int lazy, int dupli, int solver, string sol_name)
@@ -27,31 +42,40 @@ _MAPFSAT_SAT::_MAPFSAT_SAT(int var, int cost, int moves, int lazy, int dupli, in
 	movement = moves; 			// 1 = parallel, 	2 = pebble
 	lazy_const = lazy; 			// 1 = eager, 		2 = lazy
 	duplicates = dupli; 		// 1 = forbid, 		2 = allow
-	solver_to_use = solver; 	// 1 = CaDiCaL, 	2 = monosat
+	solver_to_use = solver; 	// 1 = CaDiCaL, 	2 = monosat, 	3 = Kissat
 
 	assert(variables == 1 || variables == 2 || variables == 3);
 	assert(cost_function == 1 || cost_function == 2);
 	assert(movement == 1 || movement == 2);
 	assert(lazy_const == 1 || lazy_const == 2);
 	assert(duplicates == 1 || duplicates == 2);
-	assert(solver_to_use == 1);
+	assert(solver_to_use == 1 || solver_to_use == 3);
 };
 
+_MAPFSAT_ISolver* _MAPFSAT_SAT::NewSolver()
+{
+	return new _MAPFSAT_SAT(variables, cost_function, movement, lazy_const, duplicates, solver_to_use, solver_name);
+}
+
 /****************************/
 // MARK: formula
 /****************************/
 
-int _MAPFSAT_SAT::CreateFormula(int time_left)
+int _MAPFSAT_SAT::CreateFormula()
 {
-	int timesteps = inst->GetMksLB(agents) + delta;
 	int lit = nr_vars; 	// is 1 on first call
-	auto start = chrono::high_resolution_clock::now();
 
 	/********************/
 	/* create variables */
 	/********************/
 	if (first_try)	// varaibles already exist on second try of incremental solve
 	{
+		horizon_start = delta;
+		horizon_delta = delta;
+		if (IncrementalHorizon())	// create variables for the whole window of deltas
+			horizon_delta += incremental_window;
+		int timesteps = inst->GetMksLB(agents) + horizon_delta;
+
 		lit = CreateAt(lit, timesteps);
 		if (variables == 2)
 			lit = CreatePass(lit, timesteps);
@@ -59,15 +83,15 @@ int _MAPFSAT_SAT::CreateFormula(int time_left)
 			lit = CreateShift(lit, timesteps);
 	}
 
-	if (TimesUp(start, chrono::high_resolution_clock::now(), time_left))
+	if (TimesUp())
 		return -1;
 
 	/*************/
 	/* conflicts */
 	/*************/
-	if (lazy_const == 1)	// eager
+	if (lazy_const == 1 && first_try)	// eager
 	{
-		CreateConf_Vertex();
+		lit = CreateConf_Vertex(lit);
 		if (movement == 1)	// parallel
 		{
 			if (variables == 1)
@@ -76,6 +100,8 @@ int _MAPFSAT_SAT::CreateFormula(int time_left)
 				CreateConf_Swapping_Pass();
 			if (variables == 3)
 				CreateConf_Swapping_Shift();
+			if (corridor_conflicts && variables != 3)
+				lit = CreateConf_Swapping_Corridor(lit);
 		}
 		if (movement == 2)	// pebble
 		{
@@ -113,7 +139,7 @@ int _MAPFSAT_SAT::CreateFormula(int time_left)
 	if (!first_try)		// movment clauses already exist
 		return lit;
 
-	if (TimesUp(start, chrono::high_resolution_clock::now(), time_left))
+	if (TimesUp())
 		return -1;
 
 	/***************************/
@@ -123,8 +149,9 @@ int _MAPFSAT_SAT::CreateFormula(int time_left)
 	CreatePossition_Goal();
 	if (cost_function == 2)
 		CreatePossition_NoneAtGoal();
+	CreateConst_MDD();
 
-	if (TimesUp(start, chrono::high_resolution_clock::now(), time_left))
+	if (TimesUp())
 		return -1;
 	
 	/************/
@@ -147,21 +174,23 @@ int _MAPFSAT_SAT::CreateFormula(int time_left)
 		CreateMove_NextVertex_Shift();
 	}
 
-	if (TimesUp(start, chrono::high_resolution_clock::now(), time_left))
+	if (TimesUp())
 		return -1;
 
 	/**************/
 	/* limit cost */
 	/**************/
-	if (cost_function == 2 && delta > 0)
+	if (cost_function == 2 && horizon_delta > 0)
 	{
 		if (duplicates == 1)
 			lit = CreateConst_LimitSoc(lit);
 		if (duplicates == 2)
 			lit = CreateConst_LimitSoc_AllAt(lit);
 	}
+	if (cost_function == 1 && IncrementalHorizon())
+		lit = CreateConst_LimitMks(lit);
 
-	if (TimesUp(start, chrono::high_resolution_clock::now(), time_left))
+	if (TimesUp())
 		return -1;
 
 	/*******************/
@@ -170,7 +199,7 @@ int _MAPFSAT_SAT::CreateFormula(int time_left)
 	if (use_avoid)
 		CreateConst_Avoid();
 
-	if (TimesUp(start, chrono::high_resolution_clock::now(), time_left))
+	if (TimesUp())
 		return -1;
 
 	return lit;
@@ -180,19 +209,14 @@ int _MAPFSAT_SAT::CreateFormula(int time_left)
 // MARK: aux
 /****************************/
 
-void _MAPFSAT_SAT::AddClause(vector<int> clause)
+void _MAPFSAT_SAT::AddLiteral(int lit)
 {
-	nr_clauses++;
-	for (size_t i = 0; i < clause.size(); i++)
-		((CaDiCaL::Solver*)SAT_solver)->add(clause[i]);
-	((CaDiCaL::Solver*)SAT_solver)->add(0);
+	((CaDiCaL::Solver*)SAT_solver)->add(lit);
 
-	if (cnf_file.compare("") != 0)
-	{
-		for (size_t i = 0; i < clause.size(); i++)
-			cnf_printable << clause[i] << " ";
-		cnf_printable << "0\n";
-	}
+	if (cnf_writer.IsOpen())
+		cnf_writer.AddLiteral(lit);
+	if (binary_writer.IsOpen())
+		binary_writer.AddLiteral(lit, clause_family);
 }
 
 void _MAPFSAT_SAT::CreateSolver()
@@ -206,54 +230,201 @@ void _MAPFSAT_SAT::ReleaseSolver()
 	SAT_solver = NULL;
 }
 
-int _MAPFSAT_SAT::InvokeSolverImplementation(int timelimit)
+int _MAPFSAT_SAT::InvokeSolverImplementation()
 {
-	bool ended = false;
-	thread waiting_thread = thread(WaitForTerminate, timelimit, SAT_solver, ref(ended));
+	_MAPFSAT_CaDiCaLTerminator terminator(deadline);
+	((CaDiCaL::Solver*)SAT_solver)->connect_terminator(&terminator);
 	
+	for (size_t i = 0; i < assumptions.size(); i++)
+		((CaDiCaL::Solver*)SAT_solver)->assume(assumptions[i]);
+
 	int ret = ((CaDiCaL::Solver*)SAT_solver)->solve(); // Start solver // 20 = UNSAT; 10 = SAT; 0 = UNKNOWN (reached through terminate)
 
-	ended = true;
-	waiting_thread.join();
+	((CaDiCaL::Solver*)SAT_solver)->disconnect_terminator();
 
 	if ((print_plan || keep_plan || lazy_const == 2) && ret == 10)	// create plan from variables
+		CreatePlan();
+
+	return (ret == 10) ? 0 : 1;
+}
+
+void _MAPFSAT_SAT::CreatePlan()
+{
+	int timesteps = inst->GetMksLB(agents) + delta;	// formula may contain more timesteps in case of incremental solving
+	plan = vector<vector<int> >(agents, vector<int>(timesteps));
+
+	for (int a = 0; a < agents; a++)
 	{
-		plan = vector<vector<int> >(agents, vector<int>(max_timestep));
+		int v = inst->map[inst->agents[a].start.x][inst->agents[a].start.y];
+		plan[a][0] = v;
 
-		for (int a = 0; a < agents; a++)
+		for (int t = 1; t < timesteps; t++)
 		{
-			int v = inst->map[inst->agents[a].start.x][inst->agents[a].start.y];
-			plan[a][0] = v;
+			v = GetNextVertex(a, v, t);
+			plan[a][t] = v;
+		}
+	}
+
+	if (cost_function == 2)
+		NormalizePlan();
+}
 
-			for (int t = 1; t < max_timestep; t++)
+int _MAPFSAT_SAT::Value(int var)
+{
+	return ((CaDiCaL::Solver*)SAT_solver)->val(var);
+}
+
+int _MAPFSAT_SAT::ReplayFormula(string binary_file, int timeout, bool quiet)
+{
+	int fd = open(binary_file.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		cerr << "could not open formula file " << binary_file << endl;
+		return -1;
+	}
+	struct stat file_stat;
+	fstat(fd, &file_stat);
+	size_t size = file_stat.st_size;
+	const unsigned char* data = (size < 24) ? NULL : (const unsigned char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == NULL || data == MAP_FAILED || string((const char*)data, 8) != "MAPFSATB" || data[8] != 1)
+	{
+		cerr << "not a formula file " << binary_file << endl;
+		if (data != NULL && data != MAP_FAILED)
+			munmap((void*)data, size);
+		return -1;
+	}
+
+	long long max_var = (long long)data[12] | (long long)data[13] << 8 | (long long)data[14] << 16 | (long long)data[15] << 24;
+	size_t pos = 24;
+	bool corrupted = false;
+	auto varint = [&]() -> unsigned long long
+	{
+		unsigned long long value = 0;
+		for (int shift = 0; pos < size && shift < 64; shift += 7)
+		{
+			unsigned char byte = data[pos++];
+			value |= (unsigned long long)(byte & 0x7f) << shift;
+			if (!(byte & 0x80))
+				return value;
+		}
+		corrupted = true;
+		pos = size;
+		return 0;
+	};
+	auto text = [&]() -> string
+	{
+		size_t length = varint();
+		if (length > size - pos)
+		{
+			corrupted = true;
+			length = size - pos;
+		}
+		string s((const char*)data + pos, length);
+		pos += length;
+		return s;
+	};
+
+	// literals are differences to the previous one, each has to be a variable of the header
+	auto literal = [&](long long& lit)
+	{
+		unsigned long long zigzag = varint();
+		if ((zigzag >> 1) > 2 * (unsigned long long)max_var)
+			corrupted = true;
+		else
+			lit += (zigzag & 1) ? -(long long)((zigzag + 1) >> 1) : (long long)(zigzag >> 1);
+		if (lit == 0 || lit > max_var || lit < -max_var)
+			corrupted = true;
+		return (int)lit;
+	};
+
+	int agents = varint();
+	int delta = varint();
+	string map = text();
+	string scen = text();
+	string encoding = text();
+
+	_MAPFSAT_Deadline deadline;
+	deadline.Reset(timeout * 1000);
+	_MAPFSAT_CaDiCaLTerminator terminator(deadline);
+	CaDiCaL::Solver* solver = new CaDiCaL::Solver;
+	solver->connect_terminator(&terminator);
+	vector<long long> family_clauses(8, 0);
+	long long loading_time = 0;
+	long long solving_time = 0;
+	int solver_calls = 0;
+	int ret = 0;
+	auto start = chrono::high_resolution_clock::now();
+
+	while (pos < size && !corrupted && !deadline.Expired())
+	{
+		unsigned long long tag = varint();
+		int family = tag & 7;
+		size_t lits = tag >> 3;
+		long long lit = 0;
+		if (lits > size - pos)	// every literal takes at least one byte
+		{
+			corrupted = true;
+			break;
+		}
+
+		if (family != FAMILY_SOLVE)
+		{
+			for (size_t i = 0; i < lits && !corrupted; i++)
 			{
-				v = GetNextVertex(a, v, t);
-				plan[a][t] = v;
+				int next = literal(lit);
+				if (!corrupted)
+					solver->add(next);
 			}
+			if (corrupted)
+				break;
+			solver->add(0);
+			family_clauses[family]++;
+			continue;
+		}
+
+		for (size_t i = 0; i < lits && !corrupted; i++)
+		{
+			int next = literal(lit);
+			if (!corrupted)
+				solver->assume(next);
 		}
+		if (corrupted)
+			break;
+
+		auto stop = chrono::high_resolution_clock::now();
+		loading_time += chrono::duration_cast<chrono::milliseconds>(stop - start).count();
 
-		if (cost_function == 2)
-			NormalizePlan();
+		start = chrono::high_resolution_clock::now();
+		ret = solver->solve();	// 20 = UNSAT; 10 = SAT; 0 = UNKNOWN (reached through terminate)
+		stop = chrono::high_resolution_clock::now();
+
+		solving_time += chrono::duration_cast<chrono::milliseconds>(stop - start).count();
+		solver_calls++;
+		start = chrono::high_resolution_clock::now();
 	}
 
-	return (ret == 10) ? 0 : 1;
-}
+	solver->disconnect_terminator();
+	delete solver;
+	munmap((void*)data, size);
 
-void _MAPFSAT_SAT::WaitForTerminate(int time_left_ms, void* solver, bool& ended)
-{
-	while (time_left_ms > 0)
+	if (corrupted)
 	{
-		if (ended)
-			return;
+		cerr << "formula file " << binary_file << " is corrupted" << endl;
+		return -1;
+	}
 
-		this_thread::sleep_for(std::chrono::milliseconds(50));
-		time_left_ms -= 50;
+	if (!quiet)
+	{
+		cout << "Replayed formula of " << encoding << " on " << map << ", " << scen << " with " << agents << " agents and delta " << delta << endl;
+		cout << "Clauses move, dupli, conflict, soc, unit: " << family_clauses[FAMILY_MOVE] << ", " << family_clauses[FAMILY_DUPLI] << ", " << family_clauses[FAMILY_CONFLICT] << ", " << family_clauses[FAMILY_SOC] << ", " << family_clauses[FAMILY_UNIT] << endl;
+		cout << "Solver calls: " << solver_calls << endl;
+		cout << "Loading time: " << loading_time << " [ms]" << endl;
+		cout << "Solving time: " << solving_time << " [ms]" << endl;
+		cout << "Result: " << ((ret == 10) ? "sat" : (ret == 20) ? "unsat" : "unknown") << endl;
 	}
 
-	if (ended)
-		return;
-		
-	((CaDiCaL::Solver*)solver)->terminate();	// Trusting in CaDiCaL implementation
+	return (ret == 10) ? 0 : 1;
 }
 
 int _MAPFSAT_SAT::GetNextVertex(int a, int v, int t)
@@ -268,13 +439,13 @@ int _MAPFSAT_SAT::GetNextVertex(int a, int v, int t)
 			if (!inst->HasNeighbor(v,dir))
 				continue;
 			int u = inst->GetNeighbor(v, dir);
-			if (at[a][u].first_variable == 0)
+			if (At(a, u).first_variable == 0)
 				continue;
-			if (at[a][u].first_timestep > t || at[a][u].last_timestep < t)
+			if (At(a, u).first_timestep > t || At(a, u).last_timestep < t)
 				continue;
 
-			int neib_var = at[a][u].first_variable + (t - at[a][u].first_timestep);
-			if (((CaDiCaL::Solver*)SAT_solver)->val(neib_var) > 0)
+			int neib_var = At(a, u).first_variable + (t - At(a, u).first_timestep);
+			if (Value(neib_var) > 0)
 				return u;
 		}
 	}
@@ -287,13 +458,13 @@ int _MAPFSAT_SAT::GetNextVertex(int a, int v, int t)
 			if (!inst->HasNeighbor(v,dir))
 				continue;
 			int u = inst->GetNeighbor(v, dir);
-			if (pass[a][v][dir].first_variable == 0)
+			if (Pass(a, v, dir).first_variable == 0)
 				continue;
-			if (pass[a][v][dir].first_timestep > leave_t || pass[a][v][dir].last_timestep < leave_t)
+			if (Pass(a, v, dir).first_timestep > leave_t || Pass(a, v, dir).last_timestep < leave_t)
 				continue;
 
-			int pass_var = pass[a][v][dir].first_variable + (leave_t - pass[a][v][dir].first_timestep);
-			if (((CaDiCaL::Solver*)SAT_solver)->val(pass_var) > 0)
+			int pass_var = Pass(a, v, dir).first_variable + (leave_t - Pass(a, v, dir).first_timestep);
+			if (Value(pass_var) > 0)
 				return u;
 		}
 	}
@@ -306,19 +477,17 @@ int _MAPFSAT_SAT::GetNextVertex(int a, int v, int t)
 			if (!inst->HasNeighbor(v,dir))
 				continue;
 			int u = inst->GetNeighbor(v, dir);
-			if (at[a][u].first_variable == 0)
+			if (At(a, u).first_variable == 0)
 				continue;
-			if (at[a][u].first_timestep > t || at[a][u].last_timestep < t)
+			if (At(a, u).first_timestep > t || At(a, u).last_timestep < t)
 				continue;
 			
-			size_t ind = find(shift[v][dir].timestep.begin(), shift[v][dir].timestep.end(), leave_t) - shift[v][dir].timestep.begin();
+			int shift_var = ShiftVar(v, dir, leave_t);
 
-			if (ind == shift[v][dir].timestep.size() || shift[v][dir].timestep[ind] != leave_t)
+			if (shift_var == 0)
 				continue;
 
-			int shift_var = shift[v][dir].first_varaible + ind;
-
-			if (((CaDiCaL::Solver*)SAT_solver)->val(shift_var) > 0)
+			if (Value(shift_var) > 0)
 				return u;
 		}
 	}
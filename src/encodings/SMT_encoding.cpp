@@ -54,18 +54,23 @@ _MAPFSAT_SMT::_MAPFSAT_SMT(int var, int cost, int moves, int lazy, int dupli, in
 	assert(solver_to_use == 2);
 };
 
+_MAPFSAT_ISolver* _MAPFSAT_SMT::NewSolver()
+{
+	return new _MAPFSAT_SMT(variables, cost_function, movement, lazy_const, duplicates, solver_to_use, solver_name);
+}
+
 /****************************/
 // MARK: formula
 /****************************/
 
-int _MAPFSAT_SMT::CreateFormula(int time_left)
+int _MAPFSAT_SMT::CreateFormula()
 {
-	int timesteps = inst->GetMksLB(agents) + delta;
+	horizon_start = delta;
+	horizon_delta = delta;
+	int timesteps = inst->GetMksLB(agents) + horizon_delta;
 
 	int lit = 1;
 
-	auto start = chrono::high_resolution_clock::now();
-
 	/*******************************/
 	/* create variables and graphs */
 	/*******************************/
@@ -73,15 +78,19 @@ int _MAPFSAT_SMT::CreateFormula(int time_left)
 	{
 		lit = CreateAt(lit, timesteps);
 		lit = CreatePass(lit, timesteps);
-		lit = CreateMove_Graph_MonosatPass(lit);
 	}
 	if (variables == 3)
-	{
 		lit = CreateShift(lit, timesteps);
+
+	if (TimesUp())	// the variables may be incomplete
+		return -1;
+
+	if (variables == 2)
+		lit = CreateMove_Graph_MonosatPass(lit);
+	if (variables == 3)
 		lit = CreateMove_Graph_MonosatShift(lit);
-	}
 
-	if (TimesUp(start, chrono::high_resolution_clock::now(), time_left))
+	if (TimesUp())
 		return -1;
 
 	/***************************/
@@ -95,7 +104,7 @@ int _MAPFSAT_SMT::CreateFormula(int time_left)
 			CreatePossition_NoneAtGoal_Shift();
 	}
 
-	if (TimesUp(start, chrono::high_resolution_clock::now(), time_left))
+	if (TimesUp())
 		return -1;
 
 	/*************/
@@ -103,7 +112,7 @@ int _MAPFSAT_SMT::CreateFormula(int time_left)
 	/*************/
 	if (variables == 2)
 	{
-		CreateConf_Vertex();
+		lit = CreateConf_Vertex(lit);
 		CreateConf_Swapping_Pass();
 	}
 	if (variables == 3)
@@ -112,7 +121,7 @@ int _MAPFSAT_SMT::CreateFormula(int time_left)
 		CreateConf_Swapping_Shift();
 	}
 
-	if (TimesUp(start, chrono::high_resolution_clock::now(), time_left))
+	if (TimesUp())
 		return -1;
 
 	/************/
@@ -120,7 +129,7 @@ int _MAPFSAT_SMT::CreateFormula(int time_left)
 	/************/
 	if (variables == 2)
 	{
-		CreateConf_Vertex();
+		lit = CreateConf_Vertex(lit);
 		CreateConf_Swapping_Pass();
 		if (duplicates == 1)
 			lit = CreateMove_NoDuplicates(lit);
@@ -132,13 +141,13 @@ int _MAPFSAT_SMT::CreateFormula(int time_left)
 		// forbidding duplicates for shift is much harder ...
 	}
 
-	if (TimesUp(start, chrono::high_resolution_clock::now(), time_left))
+	if (TimesUp())
 		return -1;
 
 	/**************/
 	/* limit cost */
 	/**************/
-	if (cost_function == 2 && delta > 0)
+	if (cost_function == 2 && horizon_delta > 0)
 	{
 		if (variables == 2)
 		{
@@ -151,7 +160,7 @@ int _MAPFSAT_SMT::CreateFormula(int time_left)
 			lit = CreateConst_LimitSoc_Shift(lit);
 	}
 
-	if (TimesUp(start, chrono::high_resolution_clock::now(), time_left))
+	if (TimesUp())
 		return -1;
 
 	
@@ -161,7 +170,7 @@ int _MAPFSAT_SMT::CreateFormula(int time_left)
 	if (variables == 2 && use_avoid)
 		CreateConst_Avoid();
 
-	if (TimesUp(start, chrono::high_resolution_clock::now(), time_left))
+	if (TimesUp())
 		return -1;
 
 	return lit;
@@ -173,12 +182,13 @@ int _MAPFSAT_SMT::CreateFormula(int time_left)
 
 int _MAPFSAT_SMT::CreateMove_Graph_MonosatPass(int lit)
 {
+	clause_family = FAMILY_UNIT;
 	for (int a = 0; a < agents; a++)
 	{
 		// GraphTheorySolver_long g_theory = newGraph((SolverPtr)SAT_solver);
 
 		if (cnf_file.compare("") != 0)
-			cnf_printable << "digraph int 0 0 " << a << "\n";
+			cnf_writer << "digraph int 0 0 " << a << "\n";
 		
 		int vertex_id = 0;
 		unordered_map<int, int> dict;
@@ -186,29 +196,29 @@ int _MAPFSAT_SMT::CreateMove_Graph_MonosatPass(int lit)
 		// turn vertices into edges
 		for (int v = 0; v < vertices; v++)
 		{
-			if (at[a][v].first_variable == 0)
+			if (At(a, v).first_variable == 0)
 				continue;
 
-			int star_t = at[a][v].first_timestep;
-			int end_t = at[a][v].last_timestep + 1;
+			int star_t = At(a, v).first_timestep;
+			int end_t = At(a, v).last_timestep + 1;
 
 			for (int t = star_t; t < end_t; t++)
 			{
-				int at_var = at[a][v].first_variable + (t - at[a][v].first_timestep);
+				int at_var = At(a, v).first_variable + (t - At(a, v).first_timestep);
 
 				int v1 = VarToID(at_var, false, vertex_id, dict);
 				int v2 = VarToID(at_var, true, vertex_id, dict);
 
 				//g_theory->newEdge(v1, v2, at_var);
 				if (cnf_file.compare("") != 0)
-					cnf_printable << "edge " << a << " " << v1 << " " << v2 << " " << at_var << "\n";
+					cnf_writer << "edge " << a << " " << v1 << " " << v2 << " " << at_var << "\n";
 			}
 		}
 
 		// connect vertices based on pass varaibles
 		for (int v = 0; v < vertices; v++)
 		{
-			if (at[a][v].first_variable == 0)
+			if (At(a, v).first_variable == 0)
 				continue;
 
 			for (int dir = 0; dir < 5; dir++)
@@ -216,33 +226,33 @@ int _MAPFSAT_SMT::CreateMove_Graph_MonosatPass(int lit)
 				if (!inst->HasNeighbor(v, dir))
 					continue;
 				
-				if (pass[a][v][dir].first_variable == 0)
+				if (Pass(a, v, dir).first_variable == 0)
 					continue;
 
 				int u = inst->GetNeighbor(v, dir);
 
-				int star_t = pass[a][v][dir].first_timestep;
-				int end_t = pass[a][v][dir].last_timestep + 1;
+				int star_t = Pass(a, v, dir).first_timestep;
+				int end_t = Pass(a, v, dir).last_timestep + 1;
 
 				for (int t = star_t; t < end_t; t++)
 				{
-					int at_var = at[a][v].first_variable + (t - at[a][v].first_timestep);
-					int pass_var = pass[a][v][dir].first_variable + (t - pass[a][v][dir].first_timestep);
-					int neib_var = at[a][u].first_variable + (t + 1 - at[a][u].first_timestep);
+					int at_var = At(a, v).first_variable + (t - At(a, v).first_timestep);
+					int pass_var = Pass(a, v, dir).first_variable + (t - Pass(a, v, dir).first_timestep);
+					int neib_var = At(a, u).first_variable + (t + 1 - At(a, u).first_timestep);
 
 					int v2 = VarToID(at_var, true, vertex_id, dict);
 					int u1 = VarToID(neib_var, false, vertex_id, dict);
 
 					//g_theory->newEdge(v2, u1, pass_var);
 					if (cnf_file.compare("") != 0)
-						cnf_printable << "edge " << a << " " << v2 << " " << u1 << " " << pass_var << "\n";
+						cnf_writer << "edge " << a << " " << v2 << " " << u1 << " " << pass_var << "\n";
 				}
 			}
 		}
 
 		// reachability requirement
-		int at_start_var = at[a][inst->map[inst->agents[a].start.x][inst->agents[a].start.y]].first_variable;
-		_MAPFSAT_TEGAgent AV_goal = at[a][inst->map[inst->agents[a].goal.x][inst->agents[a].goal.y]];
+		int at_start_var = At(a, inst->map[inst->agents[a].start.x][inst->agents[a].start.y]).first_variable;
+		_MAPFSAT_TEGAgent AV_goal = At(a, inst->map[inst->agents[a].goal.x][inst->agents[a].goal.y]);
 		int at_goal_var = AV_goal.first_variable + (AV_goal.last_timestep - AV_goal.first_timestep);
 
 		int start_v = VarToID(at_start_var, false, vertex_id, dict);
@@ -250,8 +260,8 @@ int _MAPFSAT_SMT::CreateMove_Graph_MonosatPass(int lit)
 
 		//g_theory->reaches(start_v, goal_v, lit);
 		if (cnf_file.compare("") != 0)
-			cnf_printable << "reach " << a << " " << start_v << " " << goal_v << " " << lit << "\n";
-		AddClause(vector<int> {lit});
+			cnf_writer << "reach " << a << " " << start_v << " " << goal_v << " " << lit << "\n";
+		AddClause({lit});
 		nr_clauses_unit++;
 		lit++;
 	}
@@ -261,9 +271,10 @@ int _MAPFSAT_SMT::CreateMove_Graph_MonosatPass(int lit)
 
 int _MAPFSAT_SMT::CreateMove_Graph_MonosatShift(int lit)
 {
+	clause_family = FAMILY_UNIT;
 	// GraphTheorySolver_long g_theory = newGraph((SolverPtr)SAT_solver);
 	if (cnf_file.compare("") != 0)
-		cnf_printable << "digraph int 0 0 0\n";
+		cnf_writer << "digraph int 0 0 0\n";
 
 	int vertex_id = 0;
 	unordered_map<int, int> dict;
@@ -281,11 +292,10 @@ int _MAPFSAT_SMT::CreateMove_Graph_MonosatShift(int lit)
 
 				int u = inst->GetNeighbor(v, dir);
 
-				size_t ind = find(shift[v][dir].timestep.begin(), shift[v][dir].timestep.end(), t) - shift[v][dir].timestep.begin();
+				int shift_var = ShiftVar(v, dir, t);
 
-				if (ind != shift[v][dir].timestep.size() && shift[v][dir].timestep[ind] == t)
+				if (shift_var != 0)
 				{
-					int shift_var = shift[v][dir].first_varaible + ind;
 
 					int v_id = ((v+t)*(v+t+1)/2) + t; // Cantor pairing function
 					int node1 = VarToID(v_id, false, vertex_id, dict);
@@ -294,7 +304,7 @@ int _MAPFSAT_SMT::CreateMove_Graph_MonosatShift(int lit)
 
 					//g_theory->newEdge(v2, u1, pass_var);
 					if (cnf_file.compare("") != 0)
-						cnf_printable << "edge 0 " << node1 << " " << node2 << " " << shift_var << "\n";
+						cnf_writer << "edge 0 " << node1 << " " << node2 << " " << shift_var << "\n";
 				}
 			}
 		}
@@ -310,14 +320,14 @@ int _MAPFSAT_SMT::CreateMove_Graph_MonosatShift(int lit)
 		int v_id = ((v_start+t)*(v_start+t+1)/2) + t; // Cantor pairing function
 		int node1 = VarToID(v_id, false, vertex_id, dict);
 
-		t = inst->LastTimestep(a, v_goal, max_timestep, delta, cost_function);
+		t = inst->LastTimestep(a, v_goal, max_timestep, horizon_delta, cost_function);
 		int u_id = ((v_goal+t)*(v_goal+t+1)/2)+t; // Cantor pairing function, u is reached at t+1
 		int node2 = VarToID(u_id, false, vertex_id, dict);
 
 		//g_theory->reaches(node1, node2, lit);
 		if (cnf_file.compare("") != 0)
-			cnf_printable << "reach 0 " << node1 << " " << node2 << " " << lit << "\n";
-		AddClause(vector<int> {lit});
+			cnf_writer << "reach 0 " << node1 << " " << node2 << " " << lit << "\n";
+		AddClause({lit});
 		nr_clauses_unit++;
 		lit++;
 	}
@@ -329,15 +339,10 @@ int _MAPFSAT_SMT::CreateMove_Graph_MonosatShift(int lit)
 // MARK: aux
 /****************************/
 
-void _MAPFSAT_SMT::AddClause(vector<int> clause)
+void _MAPFSAT_SMT::AddLiteral(int lit)
 {
-	nr_clauses++;
-	if (cnf_file.compare("") != 0)
-	{
-		for (size_t i = 0; i < clause.size(); i++)
-			cnf_printable << clause[i] << " ";
-		cnf_printable << "0\n";
-	}
+	if (cnf_writer.IsOpen())
+		cnf_writer.AddLiteral(lit);
 }
 
 void _MAPFSAT_SMT::CreateSolver()
@@ -350,14 +355,18 @@ void _MAPFSAT_SMT::ReleaseSolver()
 	// using only binary for now
 }
 
-int _MAPFSAT_SMT::InvokeSolverImplementation(int timelimit)
+int _MAPFSAT_SMT::InvokeSolverImplementation()
 {
 	// working only with binary for now
-	// setTimeLimit((SolverPtr)SAT_solver, (timelimit/1000) + 1);
+	// setTimeLimit((SolverPtr)SAT_solver, (deadline.Remaining()/1000) + 1);
 	// int ret = solveLimited((SolverPtr)SAT_solver); // 0 = SAT; 1 = UNSAT; 2 = timeout
 
+	int timelimit = deadline.Remaining();
+	if (timelimit == 0)	// timeout 0 would not limit the binary at all
+		return 1;
+
 	stringstream exec;
-	exec << "timeout " << (timelimit/1000) +1
+	exec << "timeout " << timelimit / 1000.0	// fractions of a second are accepted
 		<< " ./libs/monosat" 						
 		<< " -witness-file=tmp.out"					// -witness to print assignment
 		//<< " -cpu-lim=" << (timelimit/1000) +1	// cpu limit (in s) is unrealiable
@@ -444,13 +453,13 @@ int _MAPFSAT_SMT::GetNextVertex(vector<bool>& eval, int a, int v, int t)
 			if (!inst->HasNeighbor(v,dir))
 				continue;
 			int u = inst->GetNeighbor(v, dir);
-			if (pass[a][v][dir].first_variable == 0)
+			if (Pass(a, v, dir).first_variable == 0)
 				continue;
-			if (pass[a][v][dir].first_timestep > leave_t || pass[a][v][dir].last_timestep < leave_t)
+			if (Pass(a, v, dir).first_timestep > leave_t || Pass(a, v, dir).last_timestep < leave_t)
 				continue;
 
-			int pass_var = pass[a][v][dir].first_variable + (leave_t - pass[a][v][dir].first_timestep);
-			int at_var = at[a][u].first_variable + (t - at[a][u].first_timestep);		 // no need to check existence, it has to exists, since pass exists
+			int pass_var = Pass(a, v, dir).first_variable + (leave_t - Pass(a, v, dir).first_timestep);
+			int at_var = At(a, u).first_variable + (t - At(a, u).first_timestep);		 // no need to check existence, it has to exists, since pass exists
 
 			if (eval[pass_var-1] && eval[at_var-1])
 				return u;
@@ -466,13 +475,11 @@ int _MAPFSAT_SMT::GetNextVertex(vector<bool>& eval, int a, int v, int t)
 				continue;
 			int u = inst->GetNeighbor(v, dir);
 			
-			size_t ind = find(shift[v][dir].timestep.begin(), shift[v][dir].timestep.end(), leave_t) - shift[v][dir].timestep.begin();
+			int shift_var = ShiftVar(v, dir, leave_t);
 
-			if (ind == shift[v][dir].timestep.size() || shift[v][dir].timestep[ind] != leave_t)
+			if (shift_var == 0)
 				continue;
 
-			int shift_var = shift[v][dir].first_varaible + ind;
-
 			if (eval[shift_var-1])
 				return u;
 		}
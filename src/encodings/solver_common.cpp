@@ -25,14 +25,67 @@ void _MAPFSAT_ISolver::SetData(_MAPFSAT_Instance* i, _MAPFSAT_Logger* l, int to,
 	if (quiet)
 		print_plan = false;
 
-	at = NULL;
-	pass = NULL;
-	shift = NULL;
 	shift_times_start = NULL;
 	shift_times_end = NULL;
 };
 
-void _MAPFSAT_ISolver::PrintSolveDetails(int time_left)
+void _MAPFSAT_ISolver::SetIncremental(int window)
+{
+	incremental_window = window;
+};
+
+void _MAPFSAT_ISolver::SetThreads(int nr_threads)
+{
+	threads = max(1, nr_threads);
+};
+
+void _MAPFSAT_ISolver::SetVertexAMO(int amo)
+{
+	vertex_amo = amo;
+};
+
+void _MAPFSAT_ISolver::SetBinaryFile(string bf)
+{
+	binary_file = bf;
+};
+
+void _MAPFSAT_ISolver::SetMDD(bool mdd)
+{
+	mdd_pruning = mdd;
+};
+
+void _MAPFSAT_ISolver::SetCorridors(bool corridors)
+{
+	corridor_conflicts = corridors;
+};
+
+void _MAPFSAT_ISolver::SetIndependenceDetection(bool independence)
+{
+	independence_detection = independence;
+};
+
+void _MAPFSAT_ISolver::SetConflictBounds(bool bounds)
+{
+	conflict_bounds = bounds;
+};
+
+void _MAPFSAT_ISolver::SetDeltaSearch(int strategy, int bound)
+{
+	delta_search = strategy;
+	upper_bound = bound;
+};
+
+void _MAPFSAT_ISolver::SetPortfolio(vector<_MAPFSAT_ISolver*> solvers)
+{
+	portfolio.clear();
+	if (solvers.empty())
+		return;
+	portfolio.push_back(unique_ptr<_MAPFSAT_ISolver>(NewSolver()));
+	for (size_t i = 0; i < solvers.size(); i++)
+		portfolio.push_back(unique_ptr<_MAPFSAT_ISolver>(solvers[i]));
+};
+
+void _MAPFSAT_ISolver::PrintSolveDetails()
 {
 	if (quiet)
 		return;
@@ -41,13 +94,13 @@ void _MAPFSAT_ISolver::PrintSolveDetails(int time_left)
 	cout << "Instance name: " << inst->scen_name << endl;
 	cout << "Map name: " << inst->map_name << endl;
 	cout << "Encoding used: " << solver_name << endl;
-	cout << "SAT solver used: " << ((solver_to_use == 1) ? "CaDiCaL" : "Monosat") << endl;
+	cout << "SAT solver used: " << ((solver_to_use == 1) ? "CaDiCaL" : (solver_to_use == 2) ? "Monosat" : "Kissat") << endl;
 	cout << "Optimizing function: " << ((cost_function == 1) ? "makespan" : "sum of costs") << endl;
 	cout << "Number of agents: " << agents << endl;
 	cout << "Mks LB: " << inst->GetMksLB(agents) << endl;
 	cout << "SoC LB: " << inst->GetSocLB(agents) << endl;
 	cout << "Delta: " << delta << endl;
-	cout << "Remaining time: " << time_left << " [ms]" << endl;
+	cout << "Remaining time: " << deadline.Remaining() << " [ms]" << endl;
 	cout << endl;
 };
 
@@ -57,8 +110,12 @@ void _MAPFSAT_ISolver::PrintSolveDetails(int time_left)
 
 int _MAPFSAT_ISolver::Solve(int ags, int input_delta, bool oneshot, bool keep)
 {
+	deadline.Reset(timeout * 1000, outer_deadline); // given in s, tranfer to ms
+
+	if (independence_detection && !oneshot && !use_avoid)
+		return SolveIndependent(ags, keep);
+
 	delta = input_delta;
-	int time_left = timeout * 1000; // given in s, tranfer to ms
 	long long building_time = 0;
 	long long solving_time = 0;
 	solver_calls = 0;
@@ -70,52 +127,112 @@ int _MAPFSAT_ISolver::Solve(int ags, int input_delta, bool oneshot, bool keep)
 	nr_clauses_soc = 0;
 	nr_clauses_unit = 0;
 	keep_plan = keep;
-	cnf_printable.clear();	// store cnf here if specified to print in cnf_file
 	vertex_conflicts.clear();
 	swap_conflicts.clear();
 	pebble_conflicts.clear();
 
 	SAT_solver = NULL;
-	at = NULL;
-	pass = NULL;
-	shift = NULL;
 	agents = ags;
 	vertices = inst->number_of_vertices;
 
 	first_try = true;
 
+	if (conflict_bounds && !oneshot && !use_avoid)
+	{
+		auto start = chrono::high_resolution_clock::now();
+		if (cost_function == 1)
+		{
+			log->conflict_mksLB = inst->GetConflictMksLB(agents, movement);
+			delta = max(delta, log->conflict_mksLB - inst->GetMksLB(agents));
+		}
+		else
+		{
+			log->conflict_socLB = inst->GetConflictSocLB(agents, movement);
+			delta = max(delta, log->conflict_socLB - inst->GetSocLB(agents));
+		}
+		auto stop = chrono::high_resolution_clock::now();
+		if (TimesUp())
+			return 1;
+
+		building_time += chrono::duration_cast<chrono::milliseconds>(stop - start).count();
+	}
+
+	if (!portfolio.empty())
+		return SolvePortfolio(building_time, oneshot);
+
+	// galloping search, lower_delta is the lowest delta not known to be unsat, upper_delta the lowest delta known to be sat or -1
+	binary_search = (delta_search == 1 && !oneshot && !IncrementalHorizon());
+	int lower_delta = delta;
+	int upper_delta = -1;
+	bool upper_solved = false;	// a seeded upper_delta is not confirmed by a sat call yet
+	int gallop = 1;
+	vector<vector<int> > best_plan;
+	_MAPFSAT_Logger best_log(*log);
+	auto restore_best = [&]()	// plan and statistics of upper_delta, the time of all calls is kept
+	{
+		best_log.building_time = building_time;
+		best_log.solving_time = solving_time;
+		best_log.solver_calls = solver_calls;
+		*log = best_log;
+		plan = best_plan;
+		delta = upper_delta;
+		if (print_plan && !plan.empty())
+			PrintPlan();
+		return 0;
+	};
+	auto timed_out = [&]()	// still a timeout, the plan of upper_delta is only an upper bound and is kept for GetPlan
+	{
+		log->res = 1;
+		if (upper_solved)
+		{
+			plan = best_plan;
+			if (!quiet)
+				cout << "Timeout, the lowest sat delta " << upper_delta << " is only an upper bound" << endl;
+		}
+		return 1;
+	};
+	if (binary_search && upper_bound >= 0)
+	{
+		int bound_delta = upper_bound - ((cost_function == 1) ? inst->GetMksLB(agents) : inst->GetSocLB(agents));
+		upper_delta = max(lower_delta, bound_delta);
+		delta = lower_delta + (upper_delta - lower_delta) / 2;
+	}
+	upper_bound = -1;
+
 	while (true)
 	{
 		int res = 1; // 0 = sat, 1 = unsat
 		conflicts_present = false;
 		long long current_building_time = 0;
 		long long current_solving_time = 0;
-		PrintSolveDetails(time_left);
+		PrintSolveDetails();
 
 		if (SAT_solver == NULL)	// in case of incremental solving
 			CreateSolver();
 
+		if (first_try && !cnf_file.empty())	// new formula, start a new cnf_file
+			cnf_writer.Open(cnf_file);
+		if (first_try && !binary_file.empty() && solver_to_use == 1)
+			binary_writer.Open(binary_file, log->map_name, log->scen_name, log->encoding, agents, delta);
+
 		// create formula
 		auto start = chrono::high_resolution_clock::now();
-		nr_vars = CreateFormula(time_left);
+		nr_vars = CreateFormula();
 		auto stop = chrono::high_resolution_clock::now();
-		if (TimesUp(start, stop, time_left))
-			return 1;
-
 		current_building_time = chrono::duration_cast<chrono::milliseconds>(stop - start).count();
 		building_time += current_building_time;
-		time_left -= current_building_time;
+		if (TimesUp())
+			return timed_out();
 
 		// solve formula
+		CreateAssumptions();
 		start = chrono::high_resolution_clock::now();
-		res = InvokeSolver(time_left + 100);
+		res = InvokeSolver();
 		stop = chrono::high_resolution_clock::now();
-		if (TimesUp(start, stop, time_left))
-			return 1;
-
 		current_solving_time = chrono::duration_cast<chrono::milliseconds>(stop - start).count();
 		solving_time += current_solving_time;
-		time_left -= current_solving_time;
+		if (TimesUp())
+			return timed_out();
 		
 		// log statistics
 		log->nr_vars = nr_vars;
@@ -140,11 +257,56 @@ int _MAPFSAT_ISolver::Solve(int ags, int input_delta, bool oneshot, bool keep)
 			continue;
 		}
 
+		// incremental solving, keep the solver and only relax the bound
+		if (res == 1 && !oneshot && IncrementalHorizon() && delta < horizon_delta)
+		{
+			vertex_conflicts.clear();	// already in the solver
+			swap_conflicts.clear();
+			pebble_conflicts.clear();
+			first_try = false;
+			delta++;
+			continue;
+		}
+
 		// prepare for next iteration of solving, delat++
 		CleanUp();	
 		ReleaseSolver();
-		cnf_printable.clear();
+		cnf_writer.Close();
+		binary_writer.Close();
 		first_try = true;
+
+		if (binary_search)
+		{
+			if (res == -1) 	// something went horribly wrong with the solver!
+				return 1;
+
+			if (res == 0)
+			{
+				upper_delta = delta;
+				upper_solved = true;
+				best_plan = plan;
+				best_log = *log;
+			}
+			else
+			{
+				lower_delta = delta + 1;
+				if (upper_delta >= 0 && lower_delta > upper_delta)	// the seeded bound has no solution
+					upper_delta = -1;
+			}
+
+			if (upper_solved && lower_delta >= upper_delta)	// optimal delta found, restore its plan and statistics
+				return restore_best();
+
+			if (upper_delta < 0)
+			{
+				delta += gallop;
+				gallop *= 2;
+			}
+			else
+				delta = lower_delta + (upper_delta - lower_delta) / 2;
+			continue;
+		}
+
 		delta++;
 
 		/*if (res == 0 && lazy_const == 2 && !conflicts_present) // if there are no more conflicts, return success
@@ -166,32 +328,608 @@ int _MAPFSAT_ISolver::Solve(int ags, int input_delta, bool oneshot, bool keep)
 	return 0;	// should not get here
 }
 
+/********************************/
+// MARK: portfolio
+/********************************/
+
+int _MAPFSAT_ISolver::SolvePortfolio(long long building_time, bool oneshot)
+{
+	long long solving_time = 0;
+	solver_calls = 0;
+	vector<unique_ptr<_MAPFSAT_Logger> > logs(portfolio.size());
+	string winners;
+
+	while (true)
+	{
+		PrintSolveDetails();
+
+		// every solver builds and solves the same delta, the first definitive answer cancels the others
+		_MAPFSAT_Deadline round;
+		round.Reset(deadline.Remaining(), &deadline);
+		mutex winner_mutex;
+		int winner = -1;
+		int winner_res = 1;
+		vector<thread> pool;
+		for (size_t i = 0; i < portfolio.size(); i++)
+		{
+			_MAPFSAT_ISolver* solver = portfolio[i].get();
+			logs[i].reset(new _MAPFSAT_Logger(inst, solver->solver_name));
+			solver->SetData(inst, logs[i].get(), timeout, "", true, false, use_avoid);
+			solver->SetThreads(1);
+			solver->SetVertexAMO(vertex_amo);
+			solver->SetMDD(mdd_pruning);
+			solver->SetCorridors(corridor_conflicts);
+			solver->outer_deadline = &round;
+			logs[i]->NewInstance(agents);
+
+			pool.push_back(thread([&, i, solver]()
+			{
+				int res = solver->Solve(agents, delta, true, print_plan || keep_plan);
+				if (res == 1)	// timeout or cancelled
+					return;
+				lock_guard<mutex> guard(winner_mutex);
+				if (winner == -1)
+				{
+					winner = i;
+					winner_res = res;
+					round.Cancel();
+				}
+			}));
+		}
+		for (size_t i = 0; i < pool.size(); i++)
+			pool[i].join();
+
+		if (winner == -1)	// all solvers timed out
+			return 1;
+
+		// statistics of the winning solver
+		_MAPFSAT_Logger* won = logs[winner].get();
+		building_time += won->building_time;
+		solving_time += won->solving_time;
+		solver_calls += won->solver_calls;
+		winners += (winners.empty() ? "" : ",") + portfolio[winner]->solver_name;
+
+		log->nr_vars = won->nr_vars;
+		log->nr_clauses = won->nr_clauses;
+		log->nr_clauses_move = won->nr_clauses_move;
+		log->nr_clauses_dupli = won->nr_clauses_dupli;
+		log->nr_clauses_conflict = won->nr_clauses_conflict;
+		log->nr_clauses_soc = won->nr_clauses_soc;
+		log->nr_clauses_unit = won->nr_clauses_unit;
+		log->building_time = building_time;
+		log->solving_time = solving_time;
+		log->solution_mks = inst->GetMksLB(agents) + delta;
+		log->solution_soc = (cost_function == 1) ? 0 : inst->GetSocLB(agents) + delta;
+		log->solver_calls = solver_calls;
+		log->portfolio_winners = winners;
+		log->res = (winner_res == 0) ? 0 : 1;
+
+		if (!quiet)
+			cout << "Portfolio winner: " << portfolio[winner]->solver_name << ", " << ((winner_res == 0) ? "sat" : "unsat") << endl;
+
+		if (winner_res == 0)
+		{
+			plan = portfolio[winner]->GetPlan();
+			if (print_plan)
+				PrintPlan();
+			return 0;
+		}
+
+		if (oneshot)
+			return -1;
+		delta++;
+	}
+
+	return 0;	// should not get here
+}
+
+/********************************/
+// MARK: independence detection
+/********************************/
+
+int _MAPFSAT_ISolver::SolveIndependent(int ags, bool keep)
+{
+	agents = ags;
+	vertices = inst->number_of_vertices;
+	keep_plan = keep;
+
+	log->building_time = 0;
+	log->solving_time = 0;
+	log->nr_vars = 0;
+	log->nr_clauses = 0;
+	log->nr_clauses_move = 0;
+	log->nr_clauses_dupli = 0;
+	log->nr_clauses_conflict = 0;
+	log->nr_clauses_soc = 0;
+	log->nr_clauses_unit = 0;
+	log->solver_calls = 0;
+	log->res = 1;
+
+	// every agent starts in its own group on a shortest path
+	vector<vector<int> > groups(agents);
+	vector<int> group_of(agents);
+	vector<int> group_mks(agents);
+	vector<int> group_soc(agents);
+	plan = vector<vector<int> >(agents);
+	for (int a = 0; a < agents; a++)
+	{
+		plan[a] = inst->ShortestPath(a);
+		if (plan[a].empty())	// goal is not reachable
+			return 1;
+		groups[a] = {a};
+		group_of[a] = a;
+		group_mks[a] = plan[a].size();
+		group_soc[a] = (cost_function == 1) ? 0 : plan[a].size();
+	}
+
+	map<pair<int,int>, int> replanned;	// sides of a conflicting pair of groups already replanned, groups are named by their first agent
+	vector<pair<int,int> > conflicts;
+	while (FindGroupConflicts(group_of, conflicts))
+	{
+		for (size_t i = 0; i < conflicts.size(); i++)
+		{
+			if (groups[conflicts[i].first][0] > groups[conflicts[i].second][0])
+				swap(conflicts[i].first, conflicts[i].second);
+		}
+
+		// pairs replanned on both sides are merged
+		vector<int> parent(groups.size());
+		for (size_t g = 0; g < groups.size(); g++)
+			parent[g] = g;
+		auto root = [&parent](int g)
+		{
+			while (parent[g] != g)
+			{
+				parent[g] = parent[parent[g]];
+				g = parent[g];
+			}
+			return g;
+		};
+
+		vector<int> merged(groups.size(), 0);
+		for (size_t i = 0; i < conflicts.size(); i++)
+		{
+			int g1 = conflicts[i].first;
+			int g2 = conflicts[i].second;
+			if (replanned[make_pair(groups[g1][0], groups[g2][0])] < 2)
+				continue;
+			//cout << "groups of agents " << groups[g1][0] << " and " << groups[g2][0] << " stay in conflict, merging them" << endl;
+			int r1 = root(g1);
+			int r2 = root(g2);
+			if (r1 != r2)
+				parent[max(r1, r2)] = min(r1, r2);
+			merged[g1] = merged[g2] = 1;
+		}
+
+		// otherwise the smaller group of the pair and then the other one is replanned with the same cost, avoiding the paths of all other groups
+		vector<int> replan(groups.size(), 0);
+		for (size_t i = 0; i < conflicts.size(); i++)
+		{
+			int g1 = conflicts[i].first;
+			int g2 = conflicts[i].second;
+			if (merged[g1] || merged[g2] || replan[g1] || replan[g2])
+				continue;
+			int& sides = replanned[make_pair(groups[g1][0], groups[g2][0])];
+			bool first_smaller = groups[g1].size() <= groups[g2].size();
+			replan[(sides == 0) == first_smaller ? g1 : g2] = 1;
+			sides++;
+		}
+
+		// collect the groups of this round, merged groups are solved from scratch
+		vector<vector<int> > new_groups;
+		vector<int> new_mks;
+		vector<int> new_soc;
+		vector<int> jobs;
+		vector<bool> job_replan;
+		vector<int> new_index(groups.size(), -1);
+		for (size_t g = 0; g < groups.size(); g++)
+		{
+			int r = root(g);
+			if (new_index[r] == -1)
+			{
+				new_index[r] = new_groups.size();
+				new_groups.push_back(vector<int>());
+				new_mks.push_back(group_mks[g]);
+				new_soc.push_back(group_soc[g]);
+				if (merged[g] || replan[g])
+				{
+					jobs.push_back(new_index[r]);
+					job_replan.push_back(replan[g]);
+				}
+			}
+			int n = new_index[r];
+			new_groups[n].insert(new_groups[n].end(), groups[g].begin(), groups[g].end());
+		}
+
+		size_t largest = 0;
+		for (size_t n = 0; n < new_groups.size(); n++)
+		{
+			sort(new_groups[n].begin(), new_groups[n].end());
+			largest = max(largest, new_groups[n].size());
+		}
+		int mks = *max_element(new_mks.begin(), new_mks.end());
+
+		if (!quiet)
+			cout << "Independence detection: " << new_groups.size() << " groups, largest has " << largest << " agents, solving " << jobs.size() << " groups" << endl;
+
+		// solve each group by its own solver
+		vector<unique_ptr<_MAPFSAT_Instance> > job_insts(jobs.size());
+		vector<unique_ptr<_MAPFSAT_Logger> > job_logs(jobs.size());
+		vector<vector<vector<int> > > job_plans(jobs.size());
+		vector<int> job_res(jobs.size(), 1);
+		int group_threads = max(1, threads / (int)jobs.size());
+		atomic<int> next_job(0);
+		atomic<bool> failed(false);	// the other groups are skipped once one has no plan
+		auto job_failed = [&](int j)	// a replanned group without a plan keeps the old one
+		{
+			return job_res[j] == 1 || (job_res[j] == -1 && !job_replan[j]);
+		};
+
+		auto worker = [&]()
+		{
+			int j;
+			while ((j = next_job++) < (int)jobs.size())
+			{
+				if (failed || deadline.Expired())
+					continue;
+
+				const vector<int>& group = new_groups[jobs[j]];
+				int n = group.size();
+				job_insts[j].reset(new _MAPFSAT_Instance(*inst, group));
+				_MAPFSAT_Instance* group_inst = job_insts[j].get();
+
+				// replanned groups keep their cost, under makespan they may use the makespan of all groups
+				int group_delta = 0;
+				if (job_replan[j])
+				{
+					group_delta = (cost_function == 1) ? mks - group_inst->GetMksLB(n) : new_soc[jobs[j]] - group_inst->GetSocLB(n);
+					int horizon = group_inst->GetMksLB(n) + group_delta;
+					vector<bool> in_group(agents, false);
+					for (int i = 0; i < n; i++)
+						in_group[group[i]] = true;
+					for (int a = 0; a < agents; a++)
+					{
+						if (in_group[a])
+							continue;
+						for (int t = 0; t < horizon; t++)
+						{
+							_MAPFSAT_Vertex coords = inst->IDtoCoords(plan[a][min(t, (int)plan[a].size() - 1)]);
+							group_inst->avoid_locations.push_back({{coords.y, coords.x}, t});
+						}
+					}
+				}
+
+				job_logs[j].reset(new _MAPFSAT_Logger(group_inst, solver_name));
+				unique_ptr<_MAPFSAT_ISolver> solver(NewSolver());
+				solver->SetData(group_inst, job_logs[j].get(), timeout, "", true, false, job_replan[j]);
+				solver->outer_deadline = &deadline;
+				solver->SetIncremental(incremental_window);
+				solver->SetThreads(group_threads);
+				solver->SetVertexAMO(vertex_amo);
+				solver->SetMDD(mdd_pruning);
+				solver->SetCorridors(corridor_conflicts);
+				solver->SetConflictBounds(conflict_bounds);
+				solver->SetDeltaSearch(delta_search);
+
+				job_logs[j]->NewInstance(n);
+				job_res[j] = solver->Solve(n, group_delta, job_replan[j], true);
+				job_plans[j] = solver->GetPlan();
+				if (job_failed(j))
+					failed = true;
+			}
+		};
+
+		int workers = (solver_to_use != 2) ? min(threads, (int)jobs.size()) : 1;	// monosat is called through shared files
+		if (workers <= 1)
+			worker();
+		else
+		{
+			vector<thread> pool;
+			for (int i = 0; i < workers; i++)
+				pool.push_back(thread(worker));
+			for (size_t i = 0; i < pool.size(); i++)
+				pool[i].join();
+		}
+
+		// the first failed group gives the result, skipped groups only mean a timeout
+		int result = 0;
+		for (size_t j = 0; j < jobs.size(); j++)
+		{
+			if (job_logs[j] == NULL)
+				continue;
+
+			log->building_time += job_logs[j]->building_time;
+			log->solving_time += job_logs[j]->solving_time;
+			log->nr_vars += job_logs[j]->nr_vars;
+			log->nr_clauses += job_logs[j]->nr_clauses;
+			log->nr_clauses_move += job_logs[j]->nr_clauses_move;
+			log->nr_clauses_dupli += job_logs[j]->nr_clauses_dupli;
+			log->nr_clauses_conflict += job_logs[j]->nr_clauses_conflict;
+			log->nr_clauses_soc += job_logs[j]->nr_clauses_soc;
+			log->nr_clauses_unit += job_logs[j]->nr_clauses_unit;
+			log->solver_calls += job_logs[j]->solver_calls;
+
+			if (job_failed(j) && result == 0)
+				result = job_res[j];
+			if (job_res[j] != 0)	// a replanned group with -1 has no other plan with the same cost, the old plan stays
+				continue;
+
+			const vector<int>& group = new_groups[jobs[j]];
+			for (size_t i = 0; i < group.size(); i++)
+				plan[group[i]] = job_plans[j][i];
+			new_mks[jobs[j]] = job_logs[j]->solution_mks;
+			new_soc[jobs[j]] = job_logs[j]->solution_soc;
+		}
+		if (result != 0)
+			return result;
+		for (size_t j = 0; j < jobs.size(); j++)
+		{
+			if (job_logs[j] == NULL)	// timeout
+				return 1;
+		}
+
+		groups.swap(new_groups);
+		group_mks.swap(new_mks);
+		group_soc.swap(new_soc);
+		for (size_t g = 0; g < groups.size(); g++)
+		{
+			for (size_t i = 0; i < groups[g].size(); i++)
+				group_of[groups[g][i]] = g;
+		}
+	}
+
+	// agents stay at their goals once their paths end
+	size_t max_t = 0;
+	for (int a = 0; a < agents; a++)
+		max_t = max(max_t, plan[a].size());
+	for (int a = 0; a < agents; a++)
+		plan[a].resize(max_t, plan[a].back());
+
+	log->solution_mks = *max_element(group_mks.begin(), group_mks.end());
+	log->solution_soc = 0;
+	for (size_t g = 0; g < groups.size(); g++)
+		log->solution_soc += group_soc[g];
+	log->res = 0;
+
+	if (print_plan)
+		PrintPlan();
+
+	return 0;
+}
+
+bool _MAPFSAT_ISolver::FindGroupConflicts(const vector<int>& group_of, vector<pair<int,int> >& conflicts)
+{
+	conflicts.clear();
+	auto conflict = [&](int a1, int a2)
+	{
+		if (group_of[a1] != group_of[a2])
+			conflicts.push_back(make_pair(min(group_of[a1], group_of[a2]), max(group_of[a1], group_of[a2])));
+	};
+
+	size_t max_t = 0;
+	for (int a = 0; a < agents; a++)
+		max_t = max(max_t, plan[a].size());
+	auto position = [this](int a, size_t t)
+	{
+		return plan[a][min(t, plan[a].size() - 1)];
+	};
+
+	// agent at each vertex in timesteps t and t+1, a vertex taken twice is a vertex conflict
+	vector<int> at_now(vertices, -1);
+	vector<int> at_next(vertices, -1);
+	for (int a = 0; a < agents; a++)
+	{
+		int v = position(a, 0);
+		if (at_now[v] != -1)
+			conflict(at_now[v], a);
+		else
+			at_now[v] = a;
+	}
+
+	for (size_t t = 0; t + 1 < max_t; t++)
+	{
+		for (int a = 0; a < agents; a++)
+		{
+			int v = position(a, t + 1);
+			if (at_next[v] != -1)
+				conflict(at_next[v], a);
+			else
+				at_next[v] = a;
+		}
+
+		for (int a = 0; a < agents; a++)
+		{
+			int v = position(a, t);
+			int u = position(a, t + 1);
+			if (v == u)
+				continue;
+			int other = at_now[u];
+			if (other == -1 || other == a)
+				continue;
+			if (movement == 2 || position(other, t + 1) == v)	// pebble motion can not enter an occupied vertex, parallel motion can not swap
+				conflict(a, other);
+		}
+
+		for (int a = 0; a < agents; a++)
+			at_now[position(a, t)] = -1;
+		at_now.swap(at_next);
+	}
+
+	sort(conflicts.begin(), conflicts.end());
+	conflicts.erase(unique(conflicts.begin(), conflicts.end()), conflicts.end());
+	return !conflicts.empty();
+}
+
 /****************************/
 // MARK: create varaibles
 /****************************/
 
-int _MAPFSAT_ISolver::CreateAt(int lit, int timesteps)
+void _MAPFSAT_ISolver::CreateMDD(int timesteps)
 {
-	at = new _MAPFSAT_TEGAgent*[agents];
+	mdd_first = teg_arena.Allocate<int>(agents * vertices);
+	mdd_last = teg_arena.Allocate<int>(agents * vertices);
+	mdd_holes.clear();
 
+	// other agents can not be at a goal from the last timestep of its agent on
+	vector<int> goal_agent(vertices, -1);
+	vector<int> goal_reached(vertices, timesteps);
 	for (int a = 0; a < agents; a++)
 	{
-		at[a] = new _MAPFSAT_TEGAgent[vertices];
+		int g = inst->map[inst->agents[a].goal.x][inst->agents[a].goal.y];
+		goal_agent[g] = a;
+		goal_reached[g] = inst->LastTimestep(a, g, timesteps, horizon_delta, cost_function);
+	}
+
+	vector<vector<int> > avoided(vertices);
+	if (use_avoid)
+	{
+		for (size_t i = 0; i < inst->avoid_locations.size(); i++)
+		{
+			if (inst->avoid_locations[i].t < timesteps)
+				avoided[inst->map[inst->avoid_locations[i].v.y][inst->avoid_locations[i].v.x]].push_back(inst->avoid_locations[i].t);
+		}
+	}
+
+	vector<vector<int> > layers(timesteps);	// vertices reachable from the start in each timestep
+	vector<int> reached(vertices);
+	vector<int> leads_to_goal[2] = {vector<int>(vertices), vector<int>(vertices)};	// timestep of v leading to the goal, by parity of the timestep
+	vector<int> next_in_mdd(vertices);
+
+	for (int a = 0; a < agents; a++)
+	{
+		if (deadline.Expired())
+			return;
+
+		int start = inst->map[inst->agents[a].start.x][inst->agents[a].start.y];
+		int goal = inst->map[inst->agents[a].goal.x][inst->agents[a].goal.y];
+		int goal_t = inst->LastTimestep(a, goal, timesteps, horizon_delta, cost_function);
+		int* first = mdd_first + a * vertices;
+		int* last = mdd_last + a * vertices;
+
+		// forward, positions inside the distance windows that are not taken
+		for (int t = 0; t < timesteps; t++)
+			layers[t].clear();
+		fill(reached.begin(), reached.end(), -1);
+		layers[0].push_back(start);
+		reached[start] = 0;
+		for (int t = 0; t < goal_t && t + 1 < timesteps; t++)
+		{
+			for (size_t i = 0; i < layers[t].size(); i++)
+			{
+				int v = layers[t][i];
+				for (int dir = 0; dir < 5; dir++)
+				{
+					if (!inst->HasNeighbor(v, dir))
+						continue;
+					int u = inst->GetNeighbor(v, dir);
+					if (reached[u] == t + 1)
+						continue;
+					if (inst->FirstTimestep(a, u) > t + 1 || inst->LastTimestep(a, u, timesteps, horizon_delta, cost_function) < t + 1)
+						continue;
+					if (goal_agent[u] != -1 && goal_agent[u] != a && goal_reached[u] <= t + 1)
+						continue;
+					if (find(avoided[u].begin(), avoided[u].end(), t + 1) != avoided[u].end())
+						continue;
+					reached[u] = t + 1;
+					layers[t + 1].push_back(u);
+				}
+			}
+		}
+
+		// the goal can not be reached, keep the whole windows and let the solver find out
+		if (goal_t < 0 || goal_t >= timesteps || reached[goal] != goal_t)
+		{
+			for (int v = 0; v < vertices; v++)
+			{
+				first[v] = inst->FirstTimestep(a, v);
+				last[v] = inst->LastTimestep(a, v, timesteps, horizon_delta, cost_function);
+			}
+			continue;
+		}
+
+		// backward, keep the positions leading to the goal, gaps in a window are holes
 		for (int v = 0; v < vertices; v++)
 		{
-			if (inst->FirstTimestep(a, v) <= inst->LastTimestep(a, v, timesteps, delta, cost_function))
+			first[v] = timesteps;
+			last[v] = -1;
+		}
+		fill(leads_to_goal[0].begin(), leads_to_goal[0].end(), -1);
+		fill(leads_to_goal[1].begin(), leads_to_goal[1].end(), -1);
+		fill(next_in_mdd.begin(), next_in_mdd.end(), -1);
+		for (int t = goal_t; t >= 0; t--)
+		{
+			for (size_t i = 0; i < layers[t].size(); i++)
 			{
-				at[a][v].first_variable = lit;
-				at[a][v].first_timestep = inst->FirstTimestep(a, v);
-				at[a][v].last_timestep = inst->LastTimestep(a, v, timesteps, delta, cost_function);
-				lit += at[a][v].last_timestep - at[a][v].first_timestep + 1;
-				//cout << "create at a, v " << a << ", " << v;
-				//cout << " variables from ID " << at[a][v].first_variable;
-				//cout << " timesteps from, to " << at[a][v].first_timestep << ", " << at[a][v].last_timestep << endl;
+				int v = layers[t][i];
+				bool in_mdd = (t == goal_t && v == goal);
+				for (int dir = 0; dir < 5 && !in_mdd; dir++)
+				{
+					if (inst->HasNeighbor(v, dir) && leads_to_goal[(t + 1) % 2][inst->GetNeighbor(v, dir)] == t + 1)
+						in_mdd = true;
+				}
+				if (!in_mdd)
+					continue;
+
+				leads_to_goal[t % 2][v] = t;
+				if (last[v] == -1)
+					last[v] = t;
+				first[v] = t;
+				for (int hole = t + 1; next_in_mdd[v] != -1 && hole < next_in_mdd[v]; hole++)
+					mdd_holes.push_back({a * vertices + v, hole});
+				next_in_mdd[v] = t;
 			}
-			else
+		}
+
+		// the window at the own goal is kept, the late variables count from its first timestep
+		for (int hole = inst->FirstTimestep(a, goal); hole < first[goal]; hole++)
+			mdd_holes.push_back({a * vertices + goal, hole});
+		first[goal] = inst->FirstTimestep(a, goal);
+	}
+}
+
+int _MAPFSAT_ISolver::CreateAt(int lit, int timesteps)
+{
+	mdd_first = NULL;
+	mdd_last = NULL;
+	if (mdd_pruning && solver_to_use != 2)
+		CreateMDD(timesteps);
+
+	// count the non-empty windows first, so the entries can be allocated at once
+	at_index.row_start = teg_arena.Allocate<int>(agents * vertices + 1);
+	int entries = 0;
+	for (int a = 0; a < agents; a++)
+	{
+		if (deadline.Expired())	// stop early, TimesUp drops the incomplete index before it is used
+			return lit;
+
+		for (int v = 0; v < vertices; v++)
+		{
+			at_index.row_start[a * vertices + v] = entries;
+			if (WindowFirst(a, v) <= WindowLast(a, v, timesteps))
+				entries++;
+		}
+	}
+	at_index.row_start[agents * vertices] = entries;
+	at_index.entries = teg_arena.Allocate<_MAPFSAT_TEGAgent>(entries);
+
+	_MAPFSAT_TEGAgent* entry = at_index.entries;
+	for (int a = 0; a < agents; a++)
+	{
+		if (deadline.Expired())
+			return lit;
+
+		for (int v = 0; v < vertices; v++)
+		{
+			if (WindowFirst(a, v) <= WindowLast(a, v, timesteps))
 			{
-				at[a][v].first_variable = 0;
+				entry->first_variable = lit;
+				entry->first_timestep = WindowFirst(a, v);
+				entry->last_timestep = WindowLast(a, v, timesteps);
+				lit += entry->last_timestep - entry->first_timestep + 1;
+				//cout << "create at a, v " << a << ", " << v;
+				//cout << " variables from ID " << entry->first_variable;
+				//cout << " timesteps from, to " << entry->first_timestep << ", " << entry->last_timestep << endl;
+				entry++;
 			}
 		}
 	}
@@ -203,35 +941,58 @@ int _MAPFSAT_ISolver::CreateAt(int lit, int timesteps)
 
 int _MAPFSAT_ISolver::CreatePass(int lit, int timesteps)
 {
-	pass = new _MAPFSAT_TEGAgent**[agents];
+	// one row per agent and vertex, bit dir of dirs marks an entry for that direction
+	pass_index.row_start = teg_arena.Allocate<int>(agents * vertices + 1);
+	pass_index.dirs = teg_arena.Allocate<unsigned char>(agents * vertices);
+	int entries = 0;
+	for (int a = 0; a < agents; a++)
+	{
+		if (deadline.Expired())
+			return lit;
+
+		for (int v = 0; v < vertices; v++)
+		{
+			int row = a * vertices + v;
+			pass_index.row_start[row] = entries;
+			pass_index.dirs[row] = 0;
+			for (int dir = 0; dir < 5; dir++) // 5 directions from a vertex
+			{
+				if (!inst->HasNeighbor(v, dir))
+					continue;
+				int u = inst->GetNeighbor(v, dir);
+				// agent is at v at t and at u at t+1
+				if (max(WindowFirst(a, v), WindowFirst(a, u) - 1) <= min(WindowLast(a, v, timesteps), WindowLast(a, u, timesteps) - 1))
+				{
+					pass_index.dirs[row] |= 1 << dir;
+					entries++;
+				}
+			}
+		}
+	}
+	pass_index.row_start[agents * vertices] = entries;
+	pass_index.entries = teg_arena.Allocate<_MAPFSAT_TEGAgent>(entries);
 
+	_MAPFSAT_TEGAgent* entry = pass_index.entries;
 	for (int a = 0; a < agents; a++)
 	{
-		pass[a] = new _MAPFSAT_TEGAgent*[vertices];
+		if (deadline.Expired())
+			return lit;
+
 		for (int v = 0; v < vertices; v++)
 		{
-			pass[a][v] = new _MAPFSAT_TEGAgent[5]; // 5 directions from a vertex
 			for (int dir = 0; dir < 5; dir++)
 			{
-				if (!inst->HasNeighbor(v, dir))
-				{
-					pass[a][v][dir].first_variable = 0;
+				if (!(pass_index.dirs[a * vertices + v] & (1 << dir)))
 					continue;
-				}
-				if (inst->FirstTimestep(a, v) < inst->LastTimestep(a, inst->GetNeighbor(v, dir), timesteps, delta, cost_function)) // !!! might be wrong
-				{
-					pass[a][v][dir].first_variable = lit;
-					pass[a][v][dir].first_timestep = inst->FirstTimestep(a, v);
-					pass[a][v][dir].last_timestep = inst->LastTimestep(a, inst->GetNeighbor(v, dir), timesteps, delta, cost_function) - 1;
-					lit += pass[a][v][dir].last_timestep - pass[a][v][dir].first_timestep + 1;
-					//cout << "create pass a, v, dir " << a << " " << v << " " << dir;
-					//cout << " variables from ID " << pass[a][v][dir].first_variable;
-					//cout << " timesteps from, to " << pass[a][v][dir].first_timestep << " " << pass[a][v][dir].last_timestep << endl;
-				}
-				else
-				{
-					pass[a][v][dir].first_variable = 0;
-				}
+				int u = inst->GetNeighbor(v, dir);
+				entry->first_variable = lit;
+				entry->first_timestep = max(WindowFirst(a, v), WindowFirst(a, u) - 1);
+				entry->last_timestep = min(WindowLast(a, v, timesteps), WindowLast(a, u, timesteps) - 1);
+				lit += entry->last_timestep - entry->first_timestep + 1;
+				//cout << "create pass a, v, dir " << a << " " << v << " " << dir;
+				//cout << " variables from ID " << entry->first_variable;
+				//cout << " timesteps from, to " << entry->first_timestep << " " << entry->last_timestep << endl;
+				entry++;
 			}
 		}
 	}
@@ -241,44 +1002,85 @@ int _MAPFSAT_ISolver::CreatePass(int lit, int timesteps)
 
 int _MAPFSAT_ISolver::CreateShift(int lit, int timesteps)
 {
-	shift = new _MAPFSAT_Shift*[vertices];
-	shift_times_start = new int[vertices];
-	shift_times_end = new int[vertices];
+	// one row per vertex and direction, variables are numbered in the order of the rows
+	shift_index.row_start = teg_arena.Allocate<int>(vertices * 5 + 1);
+	shift_index.first_variable = lit;
+	shift_times_start = teg_arena.Allocate<int>(vertices);
+	shift_times_end = teg_arena.Allocate<int>(vertices);
+	vector<int> timesteps_created;
+	vector<int> agents_entering(timesteps + 1);	// +1 when an agent can start traversing, -1 after its last timestep
 
 	for (int v = 0; v < vertices; v++)
 	{
-		shift[v] = new _MAPFSAT_Shift[5];	// 5 directions from a vertex
+		if (deadline.Expired())
+			return lit;
+
 		shift_times_start[v] = -1;
 		shift_times_end[v] = -1;
-		for (int dir = 0; dir < 5; dir++)
+		for (int dir = 0; dir < 5; dir++)	// 5 directions from a vertex
 		{
-			shift[v][dir].first_varaible = lit;	// does not necessary mean that there are any varaibles, check lenght of .timestep
+			shift_index.row_start[v * 5 + dir] = timesteps_created.size();
 			if (!inst->HasNeighbor(v, dir))
 					continue;
+
+			// each agent can traverse while it can be at v and at u in the next timestep, sweep over the union of the intervals
+			int u = inst->GetNeighbor(v, dir);
+			fill(agents_entering.begin(), agents_entering.end(), 0);
+			for (int a = 0; a < agents; a++)
+			{
+				int from = max({0, WindowFirst(a, v), WindowFirst(a, u) - 1});
+				int to = min({timesteps - 1, WindowLast(a, v, timesteps), WindowLast(a, u, timesteps) - 1});
+				if (from > to)
+					continue;
+				agents_entering[from]++;
+				agents_entering[to + 1]--;
+			}
+
+			int can_traverse = 0;
 			for (int t = 0; t < timesteps; t++)
 			{
-				for (int a = 0; a < agents; a++)
-				{	
-					// create shift variable only for possition only if any agent can traverse there
-					if (inst->FirstTimestep(a, v) <= t && inst->LastTimestep(a, inst->GetNeighbor(v, dir), timesteps, delta, cost_function) > t)
-					{
-						shift[v][dir].timestep.push_back(t);
-						lit++;
-						//cout << "create shift v, dir " << v << " " << dir;
-						//cout << " variable ID " << lit-1;
-						//cout << " timestep " << t << endl;
-
-						if (shift_times_start[v] == -1 || shift_times_start[v] > t)
-							shift_times_start[v] = t;
-						if (shift_times_end[v] < t)
-							shift_times_end[v] = t;
-
-						break;
-					}
-				}
+				can_traverse += agents_entering[t];
+				// create shift variable only for possition only if any agent can traverse there
+				if (can_traverse == 0)
+					continue;
+
+				timesteps_created.push_back(t);
+				lit++;
+				//cout << "create shift v, dir " << v << " " << dir;
+				//cout << " variable ID " << lit-1;
+				//cout << " timestep " << t << endl;
+
+				if (shift_times_start[v] == -1 || shift_times_start[v] > t)
+					shift_times_start[v] = t;
+				if (shift_times_end[v] < t)
+					shift_times_end[v] = t;
 			}
 		}
 	}
+	shift_index.row_start[vertices * 5] = timesteps_created.size();
+	shift_index.timesteps = teg_arena.Allocate<int>(timesteps_created.size());
+	copy(timesteps_created.begin(), timesteps_created.end(), shift_index.timesteps);
+
+	// dense window of each row, for constant time lookup of a timestep
+	shift_index.window_start = teg_arena.Allocate<int>(vertices * 5 + 1);
+	int window_size = 0;
+	for (int row = 0; row < vertices * 5; row++)
+	{
+		shift_index.window_start[row] = window_size;
+		if (shift_index.row_start[row] < shift_index.row_start[row + 1])
+			window_size += shift_index.timesteps[shift_index.row_start[row + 1] - 1] - shift_index.timesteps[shift_index.row_start[row]] + 1;
+	}
+	shift_index.window_start[vertices * 5] = window_size;
+	shift_index.window = teg_arena.Allocate<int>(window_size);
+	fill(shift_index.window, shift_index.window + window_size, 0);
+	for (int row = 0; row < vertices * 5; row++)
+	{
+		for (int i = shift_index.row_start[row]; i < shift_index.row_start[row + 1]; i++)
+		{
+			int t = shift_index.timesteps[i];
+			shift_index.window[shift_index.window_start[row] + t - shift_index.timesteps[shift_index.row_start[row]]] = shift_index.first_variable + i;
+		}
+	}
 	max_timestep = timesteps;
 
 	return lit;
@@ -288,46 +1090,113 @@ int _MAPFSAT_ISolver::CreateShift(int lit, int timesteps)
 // MARK: create constraints
 /****************************/
 
+int _MAPFSAT_ISolver::CreateSharded(int n, RangeGenerator generator, int lit)
+{
+	if (threads <= 1 || n < 2)
+		return (this->*generator)(0, n, lit);
+
+	// split the range into chunks, each chunk is built into its own buffer
+	int chunk_size = max(1, n / (threads * 16));
+	int chunks = (n + chunk_size - 1) / chunk_size;
+	vector<_MAPFSAT_ClauseBuffer> buffers(chunks);
+	atomic<int> next_chunk(0);
+	mutex done_mutex;
+	condition_variable done_cv;
+
+	auto worker = [&]()
+	{
+		int c;
+		while ((c = next_chunk++) < chunks)
+		{
+			clause_buffer = &buffers[c];
+			int last_lit = (this->*generator)(c * chunk_size, min(n, (c + 1) * chunk_size), lit);
+			clause_buffer = NULL;
+
+			lock_guard<mutex> lock(done_mutex);
+			buffers[c].last_lit = last_lit;
+			buffers[c].done = true;
+			done_cv.notify_all();
+		}
+	};
+
+	vector<thread> workers;
+	for (int i = 0; i < threads; i++)
+		workers.push_back(thread(worker));
+
+	// merge in the order of chunks, so the formula is the same as with a single thread
+	// auxiliary variables of each chunk start at lit, shift them behind the previous chunks
+	int offset = 0;
+	for (int c = 0; c < chunks; c++)
+	{
+		{
+			unique_lock<mutex> lock(done_mutex);
+			done_cv.wait(lock, [&]() { return buffers[c].done; });
+		}
+
+		vector<int>& literals = buffers[c].literals;
+		for (size_t i = 0; i < literals.size(); i++)
+		{
+			if (literals[i] >= lit)
+				AddLiteral(literals[i] + offset);
+			else if (literals[i] <= -lit)
+				AddLiteral(literals[i] - offset);
+			else
+				AddLiteral(literals[i]);
+		}
+		nr_clauses += buffers[c].clauses;
+		offset += buffers[c].last_lit - lit;
+		vector<int>().swap(literals);	// free the buffer early
+	}
+
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+
+	return lit + offset;
+}
+
 void _MAPFSAT_ISolver::CreatePossition_Start()
 {
+	clause_family = FAMILY_UNIT;
 	for (int a = 0; a < agents; a++)
 	{
-		int start_var = at[a][inst->map[inst->agents[a].start.x][inst->agents[a].start.y]].first_variable;
-		AddClause(vector<int> {start_var});
+		int start_var = At(a, inst->map[inst->agents[a].start.x][inst->agents[a].start.y]).first_variable;
+		AddClause({start_var});
 		nr_clauses_unit++;
 	}
 }
 
 void _MAPFSAT_ISolver::CreatePossition_Goal()
 {
+	clause_family = FAMILY_UNIT;
 	for (int a = 0; a < agents; a++)
 	{
-		_MAPFSAT_TEGAgent AV_goal = at[a][inst->map[inst->agents[a].goal.x][inst->agents[a].goal.y]];
+		_MAPFSAT_TEGAgent AV_goal = At(a, inst->map[inst->agents[a].goal.x][inst->agents[a].goal.y]);
 		int goal_var = AV_goal.first_variable + (AV_goal.last_timestep - AV_goal.first_timestep);
-		AddClause(vector<int> {goal_var});
+		AddClause({goal_var});
 		nr_clauses_unit++;
 	}
 }
 
 void _MAPFSAT_ISolver::CreatePossition_NoneAtGoal()
 {
+	clause_family = FAMILY_UNIT;
 	for (int a = 0; a < agents; a++)
 	{
 		int v = inst->map[inst->agents[a].goal.x][inst->agents[a].goal.y];
 		
 		for (int a2 = 0; a2 < agents; a2++)
 		{
-			if (at[a2][v].first_variable == 0)
+			if (At(a2, v).first_variable == 0)
 				continue;
 
-			int star_t = max(at[a2][v].first_timestep, at[a][v].last_timestep + 1);
-			int end_t = at[a2][v].last_timestep + 1;
+			int star_t = max(At(a2, v).first_timestep, At(a, v).last_timestep + 1);
+			int end_t = At(a2, v).last_timestep + 1;
 
 			for (int t = star_t; t < end_t; t++)
 			{
 				//cout << a2 << " can not be at " << v << ", timestep " << t << " becuase " << a << " is in goal there" << endl;
-				int a2_var = at[a2][v].first_variable + (t - at[a2][v].first_timestep);
-				AddClause(vector<int> {-a2_var});
+				int a2_var = At(a2, v).first_variable + (t - At(a2, v).first_timestep);
+				AddClause({-a2_var});
 				nr_clauses_unit++;
 			}
 		}
@@ -336,27 +1205,27 @@ void _MAPFSAT_ISolver::CreatePossition_NoneAtGoal()
 
 void _MAPFSAT_ISolver::CreatePossition_NoneAtGoal_Shift()
 {
+	clause_family = FAMILY_UNIT;
 	for (int a = 0; a < agents; a++)
 	{
 		int v = inst->map[inst->agents[a].goal.x][inst->agents[a].goal.y];
 		if (shift_times_start[v] == -1)
 			continue; 
 
-		for (int t = max(inst->LastTimestep(a, v, max_timestep, delta, cost_function), shift_times_start[v]); t <= shift_times_end[v]; t++)
+		for (int t = max(inst->LastTimestep(a, v, max_timestep, horizon_delta, cost_function), shift_times_start[v]); t <= shift_times_end[v]; t++)
 		{
 			for (int dir = 0; dir < 5; dir++)
 			{
 				if (!inst->HasNeighbor(v, dir))
 					continue;
 
-				size_t ind = find(shift[v][dir].timestep.begin(), shift[v][dir].timestep.end(), t) - shift[v][dir].timestep.begin();
+				int shift_var = ShiftVar(v, dir, t);
 
-				if (ind != shift[v][dir].timestep.size() && shift[v][dir].timestep[ind] == t)
+				if (shift_var != 0)
 				{
 					//cout << "there is no shift from " << v << ", " << dir << " in timestep " << t << " varaible " << shift_var;
 					//cout << " because " << a << " has a goal there" << endl;
-					int shift_var = shift[v][dir].first_varaible + ind;
-					AddClause(vector<int> {-shift_var});
+					AddClause({-shift_var});
 					nr_clauses_unit++;
 				}
 			}
@@ -365,103 +1234,193 @@ void _MAPFSAT_ISolver::CreatePossition_NoneAtGoal_Shift()
 	}
 }
 
-void _MAPFSAT_ISolver::CreateConf_Vertex()
+int _MAPFSAT_ISolver::CreateConf_Vertex(int lit)
 {
-	for (int v = 0; v < vertices; v++)
+	clause_family = FAMILY_CONFLICT;
+	long long clauses_before = nr_clauses;
+	if (vertex_amo == 0)
+		CreateSharded(vertices, &_MAPFSAT_ISolver::CreateConf_Vertex_Range, 0);	// no auxiliary variables
+	else
+		lit = CreateSharded(vertices, &_MAPFSAT_ISolver::CreateConf_Vertex_AMO_Range, lit);
+	nr_clauses_conflict += nr_clauses - clauses_before;
+	return lit;
+}
+
+int _MAPFSAT_ISolver::CreateConf_Vertex_Range(int from, int to, int lit)
+{
+	for (int v = from; v < to; v++)
 	{
+		if (deadline.Expired())	// stop early, TimesUp drops the incomplete formula
+			return lit;
+
 		for (int a1 = 0; a1 < agents; a1++)
 		{
-			if (at[a1][v].first_variable == 0)
+			if (At(a1, v).first_variable == 0)
 				continue;
 			for (int a2 = a1 + 1; a2 < agents; a2++)
 			{
-				if (at[a2][v].first_variable == 0)
+				if (At(a2, v).first_variable == 0)
 					continue;
-				int star_t = max(at[a1][v].first_timestep, at[a2][v].first_timestep);
-				int end_t = min(at[a1][v].last_timestep, at[a2][v].last_timestep) + 1;
+				int star_t = max(At(a1, v).first_timestep, At(a2, v).first_timestep);
+				int end_t = min(At(a1, v).last_timestep, At(a2, v).last_timestep) + 1;
 
 				for (int t = star_t; t < end_t; t++)
 				{
 					//cout << "vertex conflict at vertex " << v << ", timestep " << t << " between " << a1 << " and " << a2 << endl;
-					int a1_var = at[a1][v].first_variable + (t - at[a1][v].first_timestep);
-					int a2_var = at[a2][v].first_variable + (t - at[a2][v].first_timestep);
-					AddClause(vector<int> {-a1_var, -a2_var});
-					nr_clauses_conflict++;
+					int a1_var = At(a1, v).first_variable + (t - At(a1, v).first_timestep);
+					int a2_var = At(a2, v).first_variable + (t - At(a2, v).first_timestep);
+					AddClause({-a1_var, -a2_var});
 				}
 			}
 		}
 	}
+
+	return lit;
+}
+
+int _MAPFSAT_ISolver::CreateConf_Vertex_AMO_Range(int from, int to, int lit)
+{
+	PBConfig config = make_shared< PBConfigClass >();
+	if (vertex_amo == 2)
+		config->amo_encoder = AMO_ENCODER::COMMANDER;
+	if (vertex_amo == 3)
+		config->amo_encoder = AMO_ENCODER::KPRODUCT;
+	PB2CNF pb2cnf(config);
+	vector<vector<int> > formula;
+
+	vector<int> vars;
+	for (int v = from; v < to; v++)
+	{
+		if (deadline.Expired())
+			return lit;
+
+		int end_t = -1;
+		for (int a = 0; a < agents; a++)
+			end_t = max(end_t, At(a, v).last_timestep);
+
+		for (int t = 0; t <= end_t; t++)
+		{
+			// all agents that can be at v at timestep t
+			vars.clear();
+			for (int a = 0; a < agents; a++)
+			{
+				if (At(a, v).first_variable == 0)
+					continue;
+				if (At(a, v).first_timestep > t || At(a, v).last_timestep < t)
+					continue;
+
+				vars.push_back(At(a, v).first_variable + (t - At(a, v).first_timestep));
+			}
+
+			if (vars.size() < 2)
+				continue;
+
+			//cout << "vertex conflict at vertex " << v << ", timestep " << t << " between " << vars.size() << " agents" << endl;
+			if (vertex_amo == 1)
+			{
+				lit = CreateAMO_Sequential(vars, lit);
+				continue;
+			}
+
+			formula.clear();
+			lit = pb2cnf.encodeAtMostK(vars, 1, formula, lit) + 1;
+			for (size_t i = 0; i < formula.size(); i++)
+				AddClause(formula[i]);
+		}
+	}
+
+	return lit;
 }
 
 void _MAPFSAT_ISolver::CreateConf_Swapping_At()
 {
-	for (int v = 0; v < vertices; v++)
+	clause_family = FAMILY_CONFLICT;
+	long long clauses_before = nr_clauses;
+	CreateSharded(vertices, &_MAPFSAT_ISolver::CreateConf_Swapping_At_Range, 0);	// no auxiliary variables
+	nr_clauses_conflict += nr_clauses - clauses_before;
+}
+
+int _MAPFSAT_ISolver::CreateConf_Swapping_At_Range(int from, int to, int lit)
+{
+	for (int v = from; v < to; v++)
 	{
+		if (deadline.Expired())
+			return lit;
+
 		for (int dir = 1; dir < 5; dir++) // ignore waiting, ie. selfloops
 		{
 			if (!inst->HasNeighbor(v, dir))
 				continue;
 
 			int u = inst->GetNeighbor(v, dir);
+			if (CorridorEdge(v, u))
+				continue;
 
 			for (int a1 = 0; a1 < agents; a1++)
 			{
-				if (at[a1][v].first_variable == 0 || at[a1][u].first_variable == 0)
+				if (At(a1, v).first_variable == 0 || At(a1, u).first_variable == 0)
 					continue;
 
 				for (int a2 = a1 + 1; a2 < agents; a2++)
 				{
-					if (at[a2][u].first_variable == 0 || at[a2][v].first_variable == 0)
+					if (At(a2, u).first_variable == 0 || At(a2, v).first_variable == 0)
 						continue;
 
-					int star_t = max({at[a1][v].first_timestep, at[a1][u].first_timestep - 1, at[a2][u].first_timestep, at[a2][v].first_timestep - 1});
-					int end_t = min({at[a1][v].last_timestep, at[a1][u].last_timestep - 1, at[a2][u].last_timestep, at[a2][v].last_timestep - 1}) + 1;
+					int star_t = max({At(a1, v).first_timestep, At(a1, u).first_timestep - 1, At(a2, u).first_timestep, At(a2, v).first_timestep - 1});
+					int end_t = min({At(a1, v).last_timestep, At(a1, u).last_timestep - 1, At(a2, u).last_timestep, At(a2, v).last_timestep - 1}) + 1;
 
 					for (int t = star_t; t < end_t; t++)
 					{
 						//cout << "swapping conflict between vertices (" << v << "," << u << "), timestep " << t << " between " << a1 << " and " << a2 << endl;
-						int a1_v_var = at[a1][v].first_variable + (t - at[a1][v].first_timestep);
-						int a1_u_var = at[a1][u].first_variable + (t + 1 - at[a1][u].first_timestep);
-						int a2_v_var = at[a2][v].first_variable + (t + 1 - at[a2][v].first_timestep);
-						int a2_u_var = at[a2][u].first_variable + (t - at[a2][u].first_timestep);
-						AddClause(vector<int> {-a1_v_var, -a1_u_var, -a2_v_var, -a2_u_var});
-						nr_clauses_conflict++;
+						int a1_v_var = At(a1, v).first_variable + (t - At(a1, v).first_timestep);
+						int a1_u_var = At(a1, u).first_variable + (t + 1 - At(a1, u).first_timestep);
+						int a2_v_var = At(a2, v).first_variable + (t + 1 - At(a2, v).first_timestep);
+						int a2_u_var = At(a2, u).first_variable + (t - At(a2, u).first_timestep);
+						AddClause({-a1_v_var, -a1_u_var, -a2_v_var, -a2_u_var});
 					}
 				}
 			}
 		}
 	}
+
+	return lit;
 }
 
 void _MAPFSAT_ISolver::CreateConf_Swapping_Pass()
 {
+	clause_family = FAMILY_CONFLICT;
 	for (int v = 0; v < vertices; v++)
 	{
+		if (deadline.Expired())
+			return;
+
 		for (int dir = 1; dir < 5; dir++)
 		{
 			if (!inst->HasNeighbor(v, dir))
 				continue;
+			if (CorridorEdge(v, inst->GetNeighbor(v, dir)))
+				continue;
 			for (int a1 = 0; a1 < agents; a1++)
 			{
-				if (pass[a1][v][dir].first_variable == 0)
+				if (Pass(a1, v, dir).first_variable == 0)
 					continue;
 				for (int a2 = a1 + 1; a2 < agents; a2++)
 				{
 					int u = inst->GetNeighbor(v, dir);
 					int op_dir = inst->OppositeDir(dir);
 
-					if (pass[a2][u][op_dir].first_variable == 0)
+					if (Pass(a2, u, op_dir).first_variable == 0)
 						continue;
 
-					int star_t = max(pass[a1][v][dir].first_timestep, pass[a2][u][op_dir].first_timestep);
-					int end_t = min(pass[a1][v][dir].last_timestep, pass[a2][u][op_dir].last_timestep) + 1;
+					int star_t = max(Pass(a1, v, dir).first_timestep, Pass(a2, u, op_dir).first_timestep);
+					int end_t = min(Pass(a1, v, dir).last_timestep, Pass(a2, u, op_dir).last_timestep) + 1;
 
 					for (int t = star_t; t < end_t; t++)
 					{
 						//cout << "swapping conflict at edge (" << v << "," << u << "), timestep " << t << " between " << a1 << " and " << a2 << endl;
-						int a1_var = pass[a1][v][dir].first_variable + (t - pass[a1][v][dir].first_timestep);
-						int a2_var = pass[a2][u][op_dir].first_variable + (t - pass[a2][u][op_dir].first_timestep);
-						AddClause(vector<int> {-a1_var, -a2_var});
+						int a1_var = Pass(a1, v, dir).first_variable + (t - Pass(a1, v, dir).first_timestep);
+						int a2_var = Pass(a2, u, op_dir).first_variable + (t - Pass(a2, u, op_dir).first_timestep);
+						AddClause({-a1_var, -a2_var});
 						nr_clauses_conflict++;
 					}
 				}
@@ -472,79 +1431,202 @@ void _MAPFSAT_ISolver::CreateConf_Swapping_Pass()
 
 void _MAPFSAT_ISolver::CreateConf_Swapping_Shift()
 {
+	clause_family = FAMILY_CONFLICT;
 	// No two opposite shifts at the same time
 	for (int v = 0; v < vertices; v++)
 	{
+		if (deadline.Expired())
+			return;
+
 		for (int dir = 2; dir < 4; dir++)	// no need to check other directions to prevent multiple clauses
 		{
 			if (!inst->HasNeighbor(v, dir))
 				continue;
 			
-			for (size_t t_ind = 0; t_ind < shift[v][dir].timestep.size(); t_ind++)
+			for (size_t t_ind = 0; t_ind < Shift(v, dir).timestep.size(); t_ind++)
 			{
 				int op_dir = inst->OppositeDir(dir);
 				int u = inst->GetNeighbor(v, dir);
-				size_t ind = find(shift[u][op_dir].timestep.begin(), shift[u][op_dir].timestep.end(), shift[v][dir].timestep[t_ind]) - shift[u][op_dir].timestep.begin();
+				int shift2_var = ShiftVar(u, op_dir, Shift(v, dir).timestep[t_ind]);
 
-				if (ind == shift[u][op_dir].timestep.size() || shift[u][op_dir].timestep[ind] != shift[v][dir].timestep[t_ind]) // did not find t in opposite dir shift
+				if (shift2_var == 0) // did not find t in opposite dir shift
 					continue;
 				
 				//cout << "swapping conflict at edge (" << v << "," << u << "), timestep " << t << " using shift" << endl;
-				int shift1_var = shift[v][dir].first_varaible + t_ind;
-				int shift2_var = shift[u][op_dir].first_varaible + ind;
-				AddClause(vector<int> {-shift1_var, -shift2_var});
+				int shift1_var = Shift(v, dir).first_varaible + t_ind;
+				AddClause({-shift1_var, -shift2_var});
 				nr_clauses_conflict++;
 			}
 		}
 	}
 }
 
+int _MAPFSAT_ISolver::CreateConf_Swapping_Corridor(int lit)
+{
+	clause_family = FAMILY_CONFLICT;
+	long long clauses_before = nr_clauses;
+	lit = CreateSharded(inst->corridors.size(), &_MAPFSAT_ISolver::CreateConf_Swapping_Corridor_Range, lit);
+	nr_clauses_conflict += nr_clauses - clauses_before;
+	return lit;
+}
+
+int _MAPFSAT_ISolver::CreateConf_Swapping_Corridor_Range(int from, int to, int lit)
+{
+	// agent, variables of the move along the edge at timestep t - pass variable or at variables in t and t+1
+	vector<tuple<int,int,int> > moves[2];
+	auto collect_moves = [&](int v, int dir, int t, vector<tuple<int,int,int> >& out)
+	{
+		out.clear();
+		int u = inst->GetNeighbor(v, dir);
+		for (int a = 0; a < agents; a++)
+		{
+			if (variables == 2)
+			{
+				const _MAPFSAT_TEGAgent& pass = Pass(a, v, dir);
+				if (pass.first_variable != 0 && pass.first_timestep <= t && t <= pass.last_timestep)
+					out.push_back(make_tuple(a, pass.first_variable + (t - pass.first_timestep), 0));
+				continue;
+			}
+			const _MAPFSAT_TEGAgent& at_v = At(a, v);
+			const _MAPFSAT_TEGAgent& at_u = At(a, u);
+			if (at_v.first_variable == 0 || at_u.first_variable == 0)
+				continue;
+			if (at_v.first_timestep > t || at_v.last_timestep < t || at_u.first_timestep > t + 1 || at_u.last_timestep < t + 1)
+				continue;
+			out.push_back(make_tuple(a, at_v.first_variable + (t - at_v.first_timestep), at_u.first_variable + (t + 1 - at_u.first_timestep)));
+		}
+	};
+
+	for (int c = from; c < to; c++)
+	{
+		if (deadline.Expired())
+			return lit;
+
+		const vector<int>& cells = inst->corridors[c];
+		for (size_t i = 0; i < cells.size(); i++)
+		{
+			int v = cells[i];
+			for (int dir = 1; dir < 5; dir++) // ignore waiting, ie. selfloops
+			{
+				if (!inst->HasNeighbor(v, dir))
+					continue;
+				int u = inst->GetNeighbor(v, dir);
+				if (inst->corridor_of[u] == c && u < v)	// edges between two cells of the corridor are visited from the smaller one
+					continue;
+
+				for (int t = 0; t < max_timestep; t++)
+				{
+					collect_moves(v, dir, t, moves[0]);
+					if (moves[0].empty())
+						continue;
+					collect_moves(u, inst->OppositeDir(dir), t, moves[1]);
+					if (moves[1].empty())
+						continue;
+
+					// few agents pass the edge, pairwise clauses are shorter
+					if (moves[0].size() * moves[1].size() <= moves[0].size() + moves[1].size())
+					{
+						for (size_t i1 = 0; i1 < moves[0].size(); i1++)
+						{
+							for (size_t i2 = 0; i2 < moves[1].size(); i2++)
+							{
+								if (get<0>(moves[0][i1]) == get<0>(moves[1][i2]))
+									continue;
+
+								//cout << "swapping conflict at corridor edge (" << v << "," << u << "), timestep " << t << " between " << get<0>(moves[0][i1]) << " and " << get<0>(moves[1][i2]) << endl;
+								if (variables == 2)
+									AddClause({-get<1>(moves[0][i1]), -get<1>(moves[1][i2])});
+								else
+									AddClause({-get<1>(moves[0][i1]), -get<2>(moves[0][i1]), -get<1>(moves[1][i2]), -get<2>(moves[1][i2])});
+							}
+						}
+						continue;
+					}
+
+					// moving from v to u implies the direction, moving back implies its negation
+					//cout << "swapping conflict at corridor edge (" << v << "," << u << "), timestep " << t << " between " << moves[0].size() << " and " << moves[1].size() << " agents" << endl;
+					int direction = lit++;
+					for (int side = 0; side < 2; side++)
+					{
+						int implied = (side == 0) ? direction : -direction;
+						for (size_t j = 0; j < moves[side].size(); j++)
+						{
+							if (variables == 2)
+								AddClause({-get<1>(moves[side][j]), implied});
+							else
+								AddClause({-get<1>(moves[side][j]), -get<2>(moves[side][j]), implied});
+						}
+					}
+				}
+			}
+		}
+	}
+
+	return lit;
+}
+
 void _MAPFSAT_ISolver::CreateConf_Pebble_At()
 {
-	for (int v = 0; v < vertices; v++)
+	clause_family = FAMILY_CONFLICT;
+	long long clauses_before = nr_clauses;
+	CreateSharded(vertices, &_MAPFSAT_ISolver::CreateConf_Pebble_At_Range, 0);	// no auxiliary variables
+	nr_clauses_conflict += nr_clauses - clauses_before;
+}
+
+int _MAPFSAT_ISolver::CreateConf_Pebble_At_Range(int from, int to, int lit)
+{
+	for (int v = from; v < to; v++)
 	{
+		if (deadline.Expired())
+			return lit;
+
 		for (int a1 = 0; a1 < agents; a1++)
 		{
-			if (at[a1][v].first_variable == 0)
+			if (At(a1, v).first_variable == 0)
 				continue;
 			
 			for (int a2 = 0; a2 < agents; a2++)
 			{
 				if (a1 == a2)
 					continue;
-				if (at[a2][v].first_variable == 0)
+				if (At(a2, v).first_variable == 0)
 					continue;
 
-				int star_t = max(at[a1][v].first_timestep, at[a2][v].first_timestep + 1);
-				int end_t = min(at[a1][v].last_timestep, at[a2][v].last_timestep + 1) + 1;
+				int star_t = max(At(a1, v).first_timestep, At(a2, v).first_timestep + 1);
+				int end_t = min(At(a1, v).last_timestep, At(a2, v).last_timestep + 1) + 1;
 
 				for (int t = star_t; t < end_t; t++)
 				{
 					//cout << "pebble conflict at vertex " << v << ", timestep " << t << " between " << a1 << " and " << a2 << endl;
-					int a1_var = at[a1][v].first_variable + (t - at[a1][v].first_timestep);
-					int a2_var = at[a2][v].first_variable + (t - 1 - at[a2][v].first_timestep);
-					AddClause(vector<int> {-a1_var, -a2_var});
-					nr_clauses_conflict++;
+					int a1_var = At(a1, v).first_variable + (t - At(a1, v).first_timestep);
+					int a2_var = At(a2, v).first_variable + (t - 1 - At(a2, v).first_timestep);
+					AddClause({-a1_var, -a2_var});
 				}
 
 			}
 
 		}
 	}
+
+	return lit;
 }
 
 void _MAPFSAT_ISolver::CreateConf_Pebble_Pass()
 {
+	clause_family = FAMILY_CONFLICT;
 	// Pass(a1,t,u,v) -> forall a2: -At(a2,t,v)
 	for (int v = 0; v < vertices; v++)
 	{
+		if (deadline.Expired())
+			return;
+
 		for (int dir = 1; dir < 5; dir++) // ignore waiting, ie. selfloops
 		{
 			if (!inst->HasNeighbor(v, dir))
 				continue;
 			for (int a1 = 0; a1 < agents; a1++)
 			{
-				if (pass[a1][v][dir].first_variable == 0)
+				if (Pass(a1, v, dir).first_variable == 0)
 					continue;
 				for (int a2 = 0; a2 < agents; a2++)
 				{
@@ -552,18 +1634,18 @@ void _MAPFSAT_ISolver::CreateConf_Pebble_Pass()
 						continue;
 
 					int u = inst->GetNeighbor(v, dir);
-					if (at[a2][u].first_variable == 0)
+					if (At(a2, u).first_variable == 0)
 						continue;
 
-					int star_t = max(pass[a1][v][dir].first_timestep, at[a2][u].first_timestep);
-					int end_t = min(pass[a1][v][dir].last_timestep, at[a2][u].last_timestep) + 1;
+					int star_t = max(Pass(a1, v, dir).first_timestep, At(a2, u).first_timestep);
+					int end_t = min(Pass(a1, v, dir).last_timestep, At(a2, u).last_timestep) + 1;
 
 					for (int t = star_t; t < end_t; t++)
 					{
 						//cout << "pebble conflict at edge (" << v << "," << u << "), timestep " << t << " between moving agent " << a1 << " and " << a2 << endl;
-						int a1_var = pass[a1][v][dir].first_variable + (t - pass[a1][v][dir].first_timestep);
-						int a2_var = at[a2][u].first_variable + (t - at[a2][u].first_timestep);
-						AddClause(vector<int> {-a1_var, -a2_var});
+						int a1_var = Pass(a1, v, dir).first_variable + (t - Pass(a1, v, dir).first_timestep);
+						int a2_var = At(a2, u).first_variable + (t - At(a2, u).first_timestep);
+						AddClause({-a1_var, -a2_var});
 						nr_clauses_conflict++;
 					}
 				}
@@ -574,30 +1656,33 @@ void _MAPFSAT_ISolver::CreateConf_Pebble_Pass()
 
 void _MAPFSAT_ISolver::CreateConf_Pebble_Shift()
 {
+	clause_family = FAMILY_CONFLICT;
 	// original paper: if shift v->u, then there is also shift u->u (vertex conflict will take care of it)
 	// our implementation: if shift v->u, then there is no shift u->w (shift u->u is possible)
 	for (int v = 0; v < vertices; v++)
 	{
+		if (deadline.Expired())
+			return;
+
 		for (int dir = 0; dir < 5; dir++)
 		{
 			if (!inst->HasNeighbor(v, dir))
 				continue;
 			
-			for (size_t t_ind = 0; t_ind < shift[v][dir].timestep.size(); t_ind++)
+			for (size_t t_ind = 0; t_ind < Shift(v, dir).timestep.size(); t_ind++)
 			{
 				int u = inst->GetNeighbor(v, dir);
-				int shift1_var = shift[v][dir].first_varaible + t_ind;
+				int shift1_var = Shift(v, dir).first_varaible + t_ind;
 
 				for (int u_dir = 1; u_dir < 5; u_dir++) // do not check waiting direction
 				{
-					size_t ind = find(shift[u][u_dir].timestep.begin(), shift[u][u_dir].timestep.end(), shift[v][dir].timestep[t_ind]) - shift[u][u_dir].timestep.begin();
+					int shift2_var = ShiftVar(u, u_dir, Shift(v, dir).timestep[t_ind]);
 
-					if (ind == shift[u][u_dir].timestep.size() || shift[u][u_dir].timestep[ind] != shift[v][dir].timestep[t_ind]) // did not find t in neighboring shift
+					if (shift2_var == 0) // did not find t in neighboring shift
 						continue;
 					
-					//cout << "pebble conflict at edge (" << v << "," << u << "), timestep " << shift[v][dir].timestep[t_ind] << " direction " << u_dir << " using shift" << endl;
-					int shift2_var = shift[u][u_dir].first_varaible + ind;
-					AddClause(vector<int> {-shift1_var, -shift2_var});
+					//cout << "pebble conflict at edge (" << v << "," << u << "), timestep " << Shift(v, dir).timestep[t_ind] << " direction " << u_dir << " using shift" << endl;
+					AddClause({-shift1_var, -shift2_var});
 					nr_clauses_conflict++;
 				}
 			}
@@ -606,29 +1691,37 @@ void _MAPFSAT_ISolver::CreateConf_Pebble_Shift()
 }
 
 int _MAPFSAT_ISolver::CreateMove_NoDuplicates(int lit)
+{
+	clause_family = FAMILY_DUPLI;
+	long long clauses_before = nr_clauses;
+	lit = CreateSharded(agents, &_MAPFSAT_ISolver::CreateMove_NoDuplicates_Range, lit);
+	nr_clauses_dupli += nr_clauses - clauses_before;
+	return lit;
+}
+
+int _MAPFSAT_ISolver::CreateMove_NoDuplicates_Range(int from, int to, int lit)
 {
 	// old - pariwise encoding
 	/*for (int a = 0; a < agents; a++)
 	{
 		for (int v = 0; v < vertices; v++)
 		{
-			if (at[a][v].first_variable == 0)
+			if (At(a, v).first_variable == 0)
 				continue;
 			for (int u = v+1; u < vertices; u++)
 			{
-				if (at[a][u].first_variable == 0)
+				if (At(a, u).first_variable == 0)
 					continue;
 
-				int star_t = max(at[a][v].first_timestep, at[a][u].first_timestep);
-				int end_t = min(at[a][v].last_timestep, at[a][u].last_timestep) + 1;
+				int star_t = max(At(a, v).first_timestep, At(a, u).first_timestep);
+				int end_t = min(At(a, v).last_timestep, At(a, u).last_timestep) + 1;
 
 				for (int t = star_t; t < end_t; t++)
 				{
 					//cout << "forbid agent " << a << " at vertices " << v << ", " << u << " at time " << t << endl;
-					int v_var = at[a][v].first_variable + (t - at[a][v].first_timestep);
-					int u_var = at[a][u].first_variable + (t - at[a][u].first_timestep);
-					AddClause(vector<int> {-v_var, -u_var});
-					nr_clauses_dupli++;
+					int v_var = At(a, v).first_variable + (t - At(a, v).first_timestep);
+					int u_var = At(a, u).first_variable + (t - At(a, u).first_timestep);
+					AddClause({-v_var, -u_var});
 				}
 			}
 		}
@@ -639,19 +1732,23 @@ int _MAPFSAT_ISolver::CreateMove_NoDuplicates(int lit)
     PB2CNF pb2cnf(config);
 	vector<vector<int> > formula;
 
-	for (int a = 0; a < agents; a++)
+	vector<int> vars;
+	for (int a = from; a < to; a++)
 	{
+		if (deadline.Expired())
+			return lit;
+
 		for (int t = 0; t < max_timestep; t++)
 		{
-			vector<int> vars;
+			vars.clear();
 			for (int v = 0; v < vertices; v++)
 			{
-				if (at[a][v].first_variable == 0)
+				if (At(a, v).first_variable == 0)
 					continue;
-				if (at[a][v].first_timestep > t || at[a][v].last_timestep < t)
+				if (At(a, v).first_timestep > t || At(a, v).last_timestep < t)
 					continue;
 				
-				vars.push_back(at[a][v].first_variable + (t - at[a][v].first_timestep));
+				vars.push_back(At(a, v).first_variable + (t - At(a, v).first_timestep));
 			}
 
 			if (vars.size() > 1)
@@ -662,7 +1759,6 @@ int _MAPFSAT_ISolver::CreateMove_NoDuplicates(int lit)
 				for (size_t i = 0; i < formula.size(); i++)
 				{
 					AddClause(formula[i]);
-					nr_clauses_dupli++;
 				}
 			}
 		}
@@ -673,71 +1769,88 @@ int _MAPFSAT_ISolver::CreateMove_NoDuplicates(int lit)
 
 void _MAPFSAT_ISolver::CreateMove_NextVertex_At()
 {
-	for (int a = 0; a < agents; a++)
+	clause_family = FAMILY_MOVE;
+	long long clauses_before = nr_clauses;
+	CreateSharded(agents, &_MAPFSAT_ISolver::CreateMove_NextVertex_At_Range, 0);	// no auxiliary variables
+	nr_clauses_move += nr_clauses - clauses_before;
+}
+
+int _MAPFSAT_ISolver::CreateMove_NextVertex_At_Range(int from, int to, int lit)
+{
+	for (int a = from; a < to; a++)
 	{
+		if (deadline.Expired())
+			return lit;
+
 		for (int v = 0; v < vertices; v++)
 		{
-			if (at[a][v].first_variable == 0)
+			if (At(a, v).first_variable == 0)
 				continue;
 
-			int star_t = at[a][v].first_timestep;
-			int end_t = at[a][v].last_timestep + 1;
+			int star_t = At(a, v).first_timestep;
+			int end_t = At(a, v).last_timestep + 1;
 
 			for (int t = star_t; t < end_t; t++)
 			{
 				int neib_t = t+1;
-				vector<int> neibs;
+				int neibs[6];	// at most 5 directions and the at variable
+				int nr_neibs = 0;
 				for (int dir = 0; dir < 5; dir++)
 				{
 					if (!inst->HasNeighbor(v,dir))
 						continue;
 					int u = inst->GetNeighbor(v, dir);
-					if (at[a][u].first_variable == 0)
+					if (At(a, u).first_variable == 0)
 						continue;
-					if (at[a][u].first_timestep <= neib_t && at[a][u].last_timestep >= neib_t)
+					if (At(a, u).first_timestep <= neib_t && At(a, u).last_timestep >= neib_t)
 					{
 						//cout << a << " can move from " << v << " into " << u << " at timestep " << t << endl;
-						int neib_var = at[a][u].first_variable + (neib_t - at[a][u].first_timestep);
-						neibs.push_back(neib_var);
+						int neib_var = At(a, u).first_variable + (neib_t - At(a, u).first_timestep);
+						neibs[nr_neibs++] = neib_var;
 					}
 				}
 
-				if (neibs.empty())
+				if (nr_neibs == 0)
 					continue;
 				
-				int at_var = at[a][v].first_variable + (t - at[a][v].first_timestep);
-				neibs.push_back(-at_var);
+				int at_var = At(a, v).first_variable + (t - At(a, v).first_timestep);
+				neibs[nr_neibs++] = -at_var;
 
-				AddClause(neibs);
-				nr_clauses_move++;
+				AddClause(neibs, nr_neibs);
 			}
 		}
 	}
+
+	return lit;
 }
 
 void _MAPFSAT_ISolver::CreateMove_EnterVertex_Pass()
 {
+	clause_family = FAMILY_MOVE;
 	for (int v = 0; v < vertices; v++)
 	{
+		if (deadline.Expired())
+			return;
+
 		for (int dir = 0; dir < 5; dir++)
 		{
 			if (!inst->HasNeighbor(v, dir))
 				continue;
 			for (int a = 0; a < agents; a++)
 			{
-				if (pass[a][v][dir].first_variable == 0)
+				if (Pass(a, v, dir).first_variable == 0)
 					continue;
-				int star_t = pass[a][v][dir].first_timestep;
-				int end_t = pass[a][v][dir].last_timestep + 1;
+				int star_t = Pass(a, v, dir).first_timestep;
+				int end_t = Pass(a, v, dir).last_timestep + 1;
 
 				for (int t = star_t; t < end_t; t++)
 				{
 					int u = inst->GetNeighbor(v, dir);
-					int pass_var = pass[a][v][dir].first_variable + (t - pass[a][v][dir].first_timestep);
-					int at_var = at[a][u].first_variable + (t + 1 - at[a][u].first_timestep);
+					int pass_var = Pass(a, v, dir).first_variable + (t - Pass(a, v, dir).first_timestep);
+					int at_var = At(a, u).first_variable + (t + 1 - At(a, u).first_timestep);
 
 					//cout << "moving agent " << a << " over (" << v << ", " << u << ") at timestep " << t << " will lead to " << u << endl;
-					AddClause(vector<int> {-pass_var, at_var});
+					AddClause({-pass_var, at_var});
 					nr_clauses_move++;
 				}
 			}
@@ -747,26 +1860,30 @@ void _MAPFSAT_ISolver::CreateMove_EnterVertex_Pass()
 
 void _MAPFSAT_ISolver::CreateMove_LeaveVertex_Pass()
 {
+	clause_family = FAMILY_MOVE;
 	for (int v = 0; v < vertices; v++)
 	{
+		if (deadline.Expired())
+			return;
+
 		for (int dir = 0; dir < 5; dir++)
 		{
 			if (!inst->HasNeighbor(v, dir))
 				continue;
 			for (int a = 0; a < agents; a++)
 			{
-				if (pass[a][v][dir].first_variable == 0)
+				if (Pass(a, v, dir).first_variable == 0)
 					continue;
-				int star_t = pass[a][v][dir].first_timestep;
-				int end_t = pass[a][v][dir].last_timestep + 1;
+				int star_t = Pass(a, v, dir).first_timestep;
+				int end_t = Pass(a, v, dir).last_timestep + 1;
 
 				for (int t = star_t; t < end_t; t++)
 				{
-					int pass_var = pass[a][v][dir].first_variable + (t - pass[a][v][dir].first_timestep);
-					int at_var = at[a][v].first_variable + (t - at[a][v].first_timestep);
+					int pass_var = Pass(a, v, dir).first_variable + (t - Pass(a, v, dir).first_timestep);
+					int at_var = At(a, v).first_variable + (t - At(a, v).first_timestep);
 
 					//cout << "agent " << a << " is moving from << v << in direction " << dir << " at timestep " << t << " means he was in " << v << endl;
-					AddClause(vector<int> {-pass_var, at_var});
+					AddClause({-pass_var, at_var});
 					nr_clauses_move++;
 				}
 			}
@@ -776,38 +1893,43 @@ void _MAPFSAT_ISolver::CreateMove_LeaveVertex_Pass()
 
 void _MAPFSAT_ISolver::CreateMove_NextEdge_Pass()
 {
+	clause_family = FAMILY_MOVE;
 	for (int a = 0; a < agents; a++)
 	{
+		if (deadline.Expired())
+			return;
+
 		for (int v = 0; v < vertices; v++)
 		{
-			if (at[a][v].first_variable == 0)
+			if (At(a, v).first_variable == 0)
 				continue;
 
-			int star_t = at[a][v].first_timestep;
-			int end_t = at[a][v].last_timestep + 1;
+			int star_t = At(a, v).first_timestep;
+			int end_t = At(a, v).last_timestep + 1;
 
 			for (int t = star_t; t < end_t; t++)
 			{
-				vector<int> neibs;
+				int neibs[6];	// at most 5 directions and the at variable
+				int nr_neibs = 0;
 				for (int dir = 0; dir < 5; dir++)
 				{
-					if (pass[a][v][dir].first_variable == 0)
+					if (Pass(a, v, dir).first_variable == 0)
 						continue;
-					if (pass[a][v][dir].first_timestep <= t && pass[a][v][dir].last_timestep >= t)
+					if (Pass(a, v, dir).first_timestep <= t && Pass(a, v, dir).last_timestep >= t)
 					{
 						//cout << a << " can move from " << v << " in " << dir << " at timestep " << t << endl;
-						int pass_var = pass[a][v][dir].first_variable + (t - pass[a][v][dir].first_timestep);
-						neibs.push_back(pass_var);
+						int pass_var = Pass(a, v, dir).first_variable + (t - Pass(a, v, dir).first_timestep);
+						neibs[nr_neibs++] = pass_var;
 					}
 				}
 
-				if (neibs.empty())
+				if (nr_neibs == 0)
 					continue;
 				
-				int at_var = at[a][v].first_variable + (t - at[a][v].first_timestep);
-				neibs.push_back(-at_var);
+				int at_var = At(a, v).first_variable + (t - At(a, v).first_timestep);
+				neibs[nr_neibs++] = -at_var;
 
-				AddClause(neibs);
+				AddClause(neibs, nr_neibs);
 				nr_clauses_move++;
 			}
 		}
@@ -816,39 +1938,43 @@ void _MAPFSAT_ISolver::CreateMove_NextEdge_Pass()
 
 void _MAPFSAT_ISolver::CreateMove_ExactlyOne_Shift()
 {
+	clause_family = FAMILY_MOVE;
 	// all shifts going from v sum up to at most 1
 	for (int v = 0; v < vertices; v++)
 	{
+		if (deadline.Expired())
+			return;
+
 		if (shift_times_start[v] == -1)
 			continue; 
 		for (int t = shift_times_start[v]; t <= shift_times_end[v]; t++)
 		{
-			vector<int> vc;
+			int vc[5];	// at most 5 directions
+			int nr_vc = 0;
 			for (int dir = 0; dir < 5; dir++)
 			{
 				if (!inst->HasNeighbor(v, dir))
 					continue;
 
-				size_t ind = find(shift[v][dir].timestep.begin(), shift[v][dir].timestep.end(), t) - shift[v][dir].timestep.begin();
+				int shift_var = ShiftVar(v, dir, t);
 
-				if (ind != shift[v][dir].timestep.size() && shift[v][dir].timestep[ind] == t)
+				if (shift_var != 0)
 				{
-					int shift_var = shift[v][dir].first_varaible + ind;
-					vc.push_back(shift_var);
+					vc[nr_vc++] = shift_var;
 					//cout << "there is a shift from " << v << ", " << dir << " in timestep " << t << " varaible " <<  shift_var << endl;
 				}
 			}
 
-			if (vc.empty())
+			if (nr_vc == 0)
 				continue;
 			
-			//AddClause(vc); // at least 1 - do not use!!
+			//AddClause(vc, nr_vc); // at least 1 - do not use!!
 
-			for (size_t i = 0; i < vc.size(); i++)
+			for (int i = 0; i < nr_vc; i++)
 			{
-				for (size_t j = i+1; j < vc.size(); j++)
+				for (int j = i+1; j < nr_vc; j++)
 				{
-					AddClause(vector<int>{-vc[i], -vc[j]}); // at most 1
+					AddClause({-vc[i], -vc[j]}); // at most 1
 					nr_clauses_move++;
 				}
 			}
@@ -858,9 +1984,13 @@ void _MAPFSAT_ISolver::CreateMove_ExactlyOne_Shift()
 
 void _MAPFSAT_ISolver::CreateMove_ExactlyOneIncoming_Shift()
 {
+	clause_family = FAMILY_MOVE;
 	// all shifts going into v sum up to at most 1
 	for (int v = 0; v < vertices; v++)
 	{
+		if (deadline.Expired())
+			return;
+
 		int min_t = INT_MAX;
 		int max_t = -1;
 
@@ -880,7 +2010,8 @@ void _MAPFSAT_ISolver::CreateMove_ExactlyOneIncoming_Shift()
 
 		for (int t = min_t; t <= max_t; t++)
 		{
-			vector<int> vc;
+			int vc[5];	// at most 5 directions
+			int nr_vc = 0;
 
 			for (int dir = 0; dir < 5; dir++)
 			{
@@ -890,23 +2021,22 @@ void _MAPFSAT_ISolver::CreateMove_ExactlyOneIncoming_Shift()
 				int u = inst->GetNeighbor(v,dir);
 				int op_dir = inst->OppositeDir(dir);
 
-				size_t ind = find(shift[u][op_dir].timestep.begin(), shift[u][op_dir].timestep.end(), t) - shift[u][op_dir].timestep.begin();
+				int shift_var = ShiftVar(u, op_dir, t);
 
-				if (ind != shift[u][op_dir].timestep.size() && shift[u][op_dir].timestep[ind] == t)
+				if (shift_var != 0)
 				{
-					int shift_var = shift[u][op_dir].first_varaible + ind;
-					vc.push_back(shift_var);
+					vc[nr_vc++] = shift_var;
 					//cout << "there is a shift from " << u << ", " << op_dir << " in timestep " << t << " varaible " <<  shift_var << endl;
 				}
 
-				if (vc.empty())
+				if (nr_vc == 0)
 					continue;
 
-				for (size_t i = 0; i < vc.size(); i++)
+				for (int i = 0; i < nr_vc; i++)
 				{
-					for (size_t j = i+1; j < vc.size(); j++)
+					for (int j = i+1; j < nr_vc; j++)
 					{
-						AddClause(vector<int>{-vc[i], -vc[j]}); // at most 1
+						AddClause({-vc[i], -vc[j]}); // at most 1
 						nr_clauses_move++;
 					}
 				}
@@ -917,16 +2047,20 @@ void _MAPFSAT_ISolver::CreateMove_ExactlyOneIncoming_Shift()
 
 void _MAPFSAT_ISolver::CreateMove_NextVertex_Shift()
 {
+	clause_family = FAMILY_MOVE;
 	
 	for (int a = 0; a < agents; a++)
 	{
+		if (deadline.Expired())
+			return;
+
 		for (int v = 0; v < vertices; v++)
 		{
-			if (at[a][v].first_variable == 0)
+			if (At(a, v).first_variable == 0)
 				continue;
 
-			int star_t = at[a][v].first_timestep;
-			int end_t = at[a][v].last_timestep + 1;
+			int star_t = At(a, v).first_timestep;
+			int end_t = At(a, v).last_timestep + 1;
 
 			for (int t = star_t; t < end_t; t++)
 			{
@@ -936,26 +2070,25 @@ void _MAPFSAT_ISolver::CreateMove_NextVertex_Shift()
 					if (!inst->HasNeighbor(v,dir))
 						continue;
 					int u = inst->GetNeighbor(v, dir);
-					if (at[a][u].first_variable == 0)
+					if (At(a, u).first_variable == 0)
 						continue;
-					if (at[a][u].first_timestep > neib_t || at[a][u].last_timestep < neib_t)
+					if (At(a, u).first_timestep > neib_t || At(a, u).last_timestep < neib_t)
 						continue;
 					
-					size_t ind = find(shift[v][dir].timestep.begin(), shift[v][dir].timestep.end(), t) - shift[v][dir].timestep.begin();
+					int shift_var = ShiftVar(v, dir, t);
 
-					if (ind == shift[v][dir].timestep.size() || shift[v][dir].timestep[ind] != t)
+					if (shift_var == 0)
 						continue;
 
-					int at1_var = at[a][v].first_variable + (t - at[a][v].first_timestep);
-					int at2_var = at[a][u].first_variable + (neib_t - at[a][u].first_timestep);
-					int shift_var = shift[v][dir].first_varaible + ind;
+					int at1_var = At(a, v).first_variable + (t - At(a, v).first_timestep);
+					int at2_var = At(a, u).first_variable + (neib_t - At(a, u).first_timestep);
 
 					//cout << "agent " << a << " is at " << v << " and something is moving to " << u << " at timestep " << t << endl;
 					//cout << "agent " << a << " is at " << v << " in " << t << " and at " << u << " in the next timestep, therefore something moved" << endl;
 
-					AddClause(vector<int> {-at1_var, -shift_var, at2_var}); // if at v and v shifts to u then at u in the next timestep
+					AddClause({-at1_var, -shift_var, at2_var}); // if at v and v shifts to u then at u in the next timestep
 					nr_clauses_move++;
-					AddClause(vector<int> {-at1_var, -at2_var, shift_var}); // if at v and at u in next timestep then v shifted to u 
+					AddClause({-at1_var, -at2_var, shift_var}); // if at v and at u in next timestep then v shifted to u 
 					nr_clauses_move++;
 				}
 			}
@@ -965,19 +2098,20 @@ void _MAPFSAT_ISolver::CreateMove_NextVertex_Shift()
 
 int _MAPFSAT_ISolver::CreateConst_LimitSoc(int lit)
 {
+	clause_family = FAMILY_SOC;
 	vector<int> late_variables;
 
 	for (int a = 0; a < agents; a++)
 	{
 		int goal_v = inst->map[inst->agents[a].goal.x][inst->agents[a].goal.y];
-		int at_var = at[a][goal_v].first_variable;
-		for (int d = 0; d < delta; d++)
+		int at_var = At(a, goal_v).first_variable;
+		for (int d = 0; d < horizon_delta; d++)
 		{
-			AddClause(vector<int> {at_var + d, lit});	// if agent is not at goal, it is late
+			AddClause({at_var + d, lit});	// if agent is not at goal, it is late
 			nr_clauses_soc++;
-			if (d < delta - 1)
+			if (d < horizon_delta - 1)
 			{
-				AddClause(vector<int> {lit, -(lit + 1)});	// if agent is not late at t, it is not late at t+1
+				AddClause({lit, -(lit + 1)});	// if agent is not late at t, it is not late at t+1
 				nr_clauses_soc++;
 			}
 			late_variables.push_back(lit);
@@ -986,55 +2120,90 @@ int _MAPFSAT_ISolver::CreateConst_LimitSoc(int lit)
 	}
 
 	// add constraint on sum of delays
-	PBConfig config = make_shared< PBConfigClass >();
-    config->amo_encoder = AMO_ENCODER::KPRODUCT;
-    config->amk_encoder = AMK_ENCODER::CARD;
-    PB2CNF pb2cnf(config);
-	vector<vector<int> > formula;
-	lit = pb2cnf.encodeAtMostK(late_variables, delta, formula, lit) + 1;
-
-	for (size_t i = 0; i < formula.size(); i++)
-	{
-		AddClause(formula[i]);
-		nr_clauses_soc++;
-	}
-
-	return lit;
+	return CreateConst_LimitLate(late_variables, lit);
 }
 
 int _MAPFSAT_ISolver::CreateConst_LimitSoc_AllAt(int lit)
 {
+	clause_family = FAMILY_SOC;
 	vector<int> late_variables;
 
 	for (int a = 0; a < agents; a++)
 	{
 		int goal_v = inst->map[inst->agents[a].goal.x][inst->agents[a].goal.y];
-		int t = at[a][goal_v].first_timestep;
-		for (int d = 0; d < delta; d++)
+		int t = At(a, goal_v).first_timestep;
+		for (int d = 0; d < horizon_delta; d++)
 		{
 			for (int v = 0; v < vertices; v++)
 			{
 				if (v == goal_v)
 					continue;
-				if (at[a][v].first_variable == 0)
+				if (At(a, v).first_variable == 0)
 					continue;
-				if (at[a][v].first_timestep > t + d)
+				if (At(a, v).first_timestep > t + d)
 					continue;
-				if (at[a][v].last_timestep < t + d)
+				if (At(a, v).last_timestep < t + d)
 					continue;
 				
-				int at_var = at[a][v].first_variable + (t + d - at[a][v].first_timestep);
+				int at_var = At(a, v).first_variable + (t + d - At(a, v).first_timestep);
 
 				//cout << "agent " << a << " might be in " << v << " at timestep " << t + d << endl;
 				//cout << "therefore, either " << at_var << " is not true or " << lit << " is true" << endl;
 
-				AddClause(vector<int> {-at_var, lit});	// if agent is somewhere other than at goal, it is late
+				AddClause({-at_var, lit});	// if agent is somewhere other than at goal, it is late
+				nr_clauses_soc++;
+			}
+
+			if (d < horizon_delta - 1)
+			{
+				AddClause({lit, -(lit + 1)});	// if agent is not late at t, it is not late at t+1
 				nr_clauses_soc++;
 			}
+			late_variables.push_back(lit);
+			lit++;
+		}
+	}
+
+	// add constraint on sum of delays
+	return CreateConst_LimitLate(late_variables, lit);
+}
+
+int _MAPFSAT_ISolver::CreateConst_LimitSoc_Shift(int lit)
+{
+	clause_family = FAMILY_SOC;
+	vector<int> late_variables;
+
+	for (int a = 0; a < agents; a++)
+	{
+		int goal_v = inst->map[inst->agents[a].goal.x][inst->agents[a].goal.y];
+		int t = inst->FirstTimestep(a, goal_v);
+
+		for (int d = 0; d < horizon_delta; d++)
+		{
+			vector<int> vc;
+
+			for (int dir = 1; dir < 5; dir++) // ignore waiting shifts
+			{
+				if (!inst->HasNeighbor(goal_v, dir))
+					continue;
+
+				int u = inst->GetNeighbor(goal_v,dir);
+				int op_dir = inst->OppositeDir(dir);
+
+				int shift_var = ShiftVar(u, op_dir, t+d);
+
+				if (shift_var != 0)
+				{
+
+					//cout << "there is a shift from " << u << " into " << goal_v << " at time " << t+d << " which is a goal vertex of " << a << endl;
+					AddClause({-shift_var, lit});	// if agent is somewhere other than at goal, it is late
+					nr_clauses_soc++;
+				}
+			}
 
-			if (d < delta - 1)
+			if (d < horizon_delta - 1)
 			{
-				AddClause(vector<int> {lit, -(lit + 1)});	// if agent is not late at t, it is not late at t+1
+				AddClause({lit, -(lit + 1)});	// if agent is not late at t, it is not late at t+1
 				nr_clauses_soc++;
 			}
 			late_variables.push_back(lit);
@@ -1043,6 +2212,25 @@ int _MAPFSAT_ISolver::CreateConst_LimitSoc_AllAt(int lit)
 	}
 
 	// add constraint on sum of delays
+	return CreateConst_LimitLate(late_variables, lit);
+}
+
+int _MAPFSAT_ISolver::CreateConst_LimitLate(vector<int>& late_variables, int lit)
+{
+	clause_family = FAMILY_SOC;
+	if (IncrementalHorizon())	// count the delays once, the bound is set by assumptions
+	{
+		vector<int> counter;
+		lit = CreateTotalizer(late_variables, horizon_delta + 1, counter, lit);
+
+		// horizon_lits[i] is true if the sum of delays is larger than horizon_start + i
+		horizon_lits.clear();
+		for (int d = horizon_start; d <= horizon_delta && d < (int)counter.size(); d++)
+			horizon_lits.push_back(counter[d]);
+
+		return lit;
+	}
+
 	PBConfig config = make_shared< PBConfigClass >();
     config->amo_encoder = AMO_ENCODER::KPRODUCT;
     config->amk_encoder = AMK_ENCODER::CARD;
@@ -1050,109 +2238,166 @@ int _MAPFSAT_ISolver::CreateConst_LimitSoc_AllAt(int lit)
 	vector<vector<int> > formula;
 	lit = pb2cnf.encodeAtMostK(late_variables, delta, formula, lit) + 1;
 
-	for (size_t i = 0; i < formula.size(); i++)
+	for (size_t i = 0; i < formula.size(); i++)
+	{
+		AddClause(formula[i]);
+		nr_clauses_soc++;
+	}
+
+	return lit;
+}
+
+int _MAPFSAT_ISolver::CreateTotalizer(vector<int>& inputs, int bound, vector<int>& outputs, int lit)
+{
+	// outputs[i] is true if at least i + 1 inputs are true, counting stops at bound
+	if (inputs.size() < 2)
+	{
+		outputs = inputs;
+		return lit;
+	}
+
+	vector<int> left_inputs(inputs.begin(), inputs.begin() + inputs.size() / 2);
+	vector<int> right_inputs(inputs.begin() + inputs.size() / 2, inputs.end());
+	vector<int> left, right;
+	lit = CreateTotalizer(left_inputs, bound, left, lit);
+	lit = CreateTotalizer(right_inputs, bound, right, lit);
+
+	int size = min((int)(left.size() + right.size()), bound);
+	outputs.clear();
+	for (int i = 0; i < size; i++)
+		outputs.push_back(lit++);
+
+	for (size_t i = 0; i <= left.size(); i++)
+	{
+		for (size_t j = 0; j <= right.size(); j++)
+		{
+			if (i + j == 0)
+				continue;
+
+			int sum = min((int)(i + j), size);
+			int clause[3];
+			int nr_lits = 0;
+			if (i > 0)
+				clause[nr_lits++] = -left[i-1];
+			if (j > 0)
+				clause[nr_lits++] = -right[j-1];
+			clause[nr_lits++] = outputs[sum-1];	// i of left and j of right inputs are true, so at least i + j inputs are true
+			AddClause(clause, nr_lits);
+			nr_clauses_soc++;
+		}
+	}
+
+	return lit;
+}
+
+int _MAPFSAT_ISolver::CreateAMO_Sequential(vector<int>& inputs, int lit)
+{
+	// aux lit + i is true if any of the first i + 1 inputs is true
+	int n = inputs.size();
+	AddClause({-inputs[0], lit});
+	for (int i = 1; i < n - 1; i++)
 	{
-		AddClause(formula[i]);
-		nr_clauses_soc++;
+		AddClause({-inputs[i], lit + i});
+		AddClause({-(lit + i - 1), lit + i});
+		AddClause({-inputs[i], -(lit + i - 1)});
 	}
+	AddClause({-inputs[n-1], -(lit + n - 2)});
 
-	return lit;
+	return lit + n - 1;
 }
 
-int _MAPFSAT_ISolver::CreateConst_LimitSoc_Shift(int lit)
+int _MAPFSAT_ISolver::CreateConst_LimitMks(int lit)
 {
-	vector<int> late_variables;
+	clause_family = FAMILY_MOVE;
+	// horizon_lits[i] is true if more than LB + horizon_start + i timesteps are used
+	horizon_lits.clear();
+	for (int i = 0; i < incremental_window; i++)
+	{
+		horizon_lits.push_back(lit);
+		if (i > 0)
+		{
+			AddClause({-lit, lit - 1});	// if more than t + 1 timesteps are used, more than t timesteps are used
+			nr_clauses_move++;
+		}
+		lit++;
+	}
+
+	int base_timesteps = max_timestep - incremental_window;
 
 	for (int a = 0; a < agents; a++)
 	{
 		int goal_v = inst->map[inst->agents[a].goal.x][inst->agents[a].goal.y];
-		int t = inst->FirstTimestep(a, goal_v);
-
-		for (int d = 0; d < delta; d++)
+		for (int v = 0; v < vertices; v++)
 		{
-			vector<int> vc;
-
-			for (int dir = 1; dir < 5; dir++) // ignore waiting shifts
-			{
-				if (!inst->HasNeighbor(goal_v, dir))
-					continue;
-
-				int u = inst->GetNeighbor(goal_v,dir);
-				int op_dir = inst->OppositeDir(dir);
-
-				size_t ind = find(shift[u][op_dir].timestep.begin(), shift[u][op_dir].timestep.end(), t+d) - shift[u][op_dir].timestep.begin();
-
-				if (ind != shift[u][op_dir].timestep.size() && shift[u][op_dir].timestep[ind] == t+d)
-				{
-					int shift_var = shift[u][op_dir].first_varaible + ind;
+			if (v == goal_v)	// agent waits in goal after the makespan
+				continue;
+			if (At(a, v).first_variable == 0)
+				continue;
 
-					//cout << "there is a shift from " << u << " into " << goal_v << " at time " << t+d << " which is a goal vertex of " << a << endl;
-					AddClause(vector<int> {-shift_var, lit});	// if agent is somewhere other than at goal, it is late
-					nr_clauses_soc++;
-				}
-			}
+			// being at v in t requires at least t + slack timesteps to reach the goal
+			int slack = max_timestep - inst->LastTimestep(a, v, max_timestep, horizon_delta, cost_function);
+			int star_t = max(At(a, v).first_timestep, base_timesteps - slack + 1);
+			int end_t = At(a, v).last_timestep + 1;
 
-			if (d < delta - 1)
+			for (int t = star_t; t < end_t; t++)
 			{
-				AddClause(vector<int> {lit, -(lit + 1)});	// if agent is not late at t, it is not late at t+1
-				nr_clauses_soc++;
+				//cout << "agent " << a << " can be at " << v << " at timestep " << t << " only with at least " << t + slack << " timesteps" << endl;
+				int at_var = At(a, v).first_variable + (t - At(a, v).first_timestep);
+				AddClause({-at_var, horizon_lits[t + slack - base_timesteps - 1]});
+				nr_clauses_move++;
 			}
-			late_variables.push_back(lit);
-			lit++;
 		}
 	}
 
-	// add constraint on sum of delays
-	PBConfig config = make_shared< PBConfigClass >();
-    config->amo_encoder = AMO_ENCODER::KPRODUCT;
-    config->amk_encoder = AMK_ENCODER::CARD;
-    PB2CNF pb2cnf(config);
-	vector<vector<int> > formula;
-	lit = pb2cnf.encodeAtMostK(late_variables, delta, formula, lit) + 1;
+	return lit;
+}
 
-	for (size_t i = 0; i < formula.size(); i++)
-	{
-		AddClause(formula[i]);
-		nr_clauses_soc++;
-	}
+void _MAPFSAT_ISolver::CreateAssumptions()
+{
+	assumptions.clear();
 
-	return lit;
+	// close off timesteps past the current makespan, or delays past the current sum of costs
+	if (delta - horizon_start < (int)horizon_lits.size())
+		assumptions.push_back(-horizon_lits[delta - horizon_start]);
 }
 
 void _MAPFSAT_ISolver::CreateConf_Vertex_OnDemand()
 {
+	clause_family = FAMILY_CONFLICT;
 	for (size_t i = 0; i < vertex_conflicts.size(); i++)
 	{
 		int a1, a2, v, t;
 		tie(a1, a2, v, t) = vertex_conflicts[i];
 
 		//cout << "extra vertex conflict at vertex " << v << ", timestep " << t << " between " << a1 << " and " << a2 << endl;
-		int a1_var = at[a1][v].first_variable + (t - at[a1][v].first_timestep);
-		int a2_var = at[a2][v].first_variable + (t - at[a2][v].first_timestep);
-		AddClause(vector<int> {-a1_var, -a2_var});
+		int a1_var = At(a1, v).first_variable + (t - At(a1, v).first_timestep);
+		int a2_var = At(a2, v).first_variable + (t - At(a2, v).first_timestep);
+		AddClause({-a1_var, -a2_var});
 		nr_clauses_conflict++;
 	}
 }
 
 void _MAPFSAT_ISolver::CreateConf_Swapping_At_OnDemand()
 {
+	clause_family = FAMILY_CONFLICT;
 	for (size_t i = 0; i < swap_conflicts.size(); i++)
 	{
 		int a1, a2, v, u, t;
 		tie(a1, a2, v, u, t) = swap_conflicts[i];
 
 		//cout << "extra swapping conflict between vertices (" << v << "," << u << "), timestep " << t << " between " << a1 << " and " << a2 << endl;
-		int a1_v_var = at[a1][v].first_variable + (t - at[a1][v].first_timestep);
-		int a1_u_var = at[a1][u].first_variable + (t + 1 - at[a1][u].first_timestep);
-		int a2_v_var = at[a2][v].first_variable + (t + 1 - at[a2][v].first_timestep);
-		int a2_u_var = at[a2][u].first_variable + (t - at[a2][u].first_timestep);
-		AddClause(vector<int> {-a1_v_var, -a1_u_var, -a2_v_var, -a2_u_var});
+		int a1_v_var = At(a1, v).first_variable + (t - At(a1, v).first_timestep);
+		int a1_u_var = At(a1, u).first_variable + (t + 1 - At(a1, u).first_timestep);
+		int a2_v_var = At(a2, v).first_variable + (t + 1 - At(a2, v).first_timestep);
+		int a2_u_var = At(a2, u).first_variable + (t - At(a2, u).first_timestep);
+		AddClause({-a1_v_var, -a1_u_var, -a2_v_var, -a2_u_var});
 		nr_clauses_conflict++;
 	}
 }
 
 void _MAPFSAT_ISolver::CreateConf_Swapping_Pass_OnDemand()
 {
+	clause_family = FAMILY_CONFLICT;
 	for (size_t i = 0; i < swap_conflicts.size(); i++)
 	{
 		int a1, a2, v, u, t;
@@ -1171,15 +2416,16 @@ void _MAPFSAT_ISolver::CreateConf_Swapping_Pass_OnDemand()
 		}
 
 		//cout << "extra swapping conflict at edge (" << v << "," << u << "), timestep " << t << " between " << a1 << " and " << a2 << endl;
-		int a1_var = pass[a1][v][dir].first_variable + (t - pass[a1][v][dir].first_timestep);
-		int a2_var = pass[a2][u][op_dir].first_variable + (t - pass[a2][u][op_dir].first_timestep);
-		AddClause(vector<int> {-a1_var, -a2_var});
+		int a1_var = Pass(a1, v, dir).first_variable + (t - Pass(a1, v, dir).first_timestep);
+		int a2_var = Pass(a2, u, op_dir).first_variable + (t - Pass(a2, u, op_dir).first_timestep);
+		AddClause({-a1_var, -a2_var});
 		nr_clauses_conflict++;
 	}	
 }
 
 void _MAPFSAT_ISolver::CreateConf_Swapping_Shift_OnDemand()
 {
+	clause_family = FAMILY_CONFLICT;
 	for (size_t i = 0; i < swap_conflicts.size(); i++)
 	{
 		int a1, a2, v, u, t;
@@ -1197,34 +2443,35 @@ void _MAPFSAT_ISolver::CreateConf_Swapping_Shift_OnDemand()
 			}
 		}
 		
-		size_t t_ind1 = find(shift[v][dir].timestep.begin(), shift[v][dir].timestep.end(), t) - shift[v][dir].timestep.begin();
-		size_t t_ind2 = find(shift[u][op_dir].timestep.begin(), shift[u][op_dir].timestep.end(), t) - shift[u][op_dir].timestep.begin();
+		int shift1_var = ShiftVar(v, dir, t);
+		int shift2_var = ShiftVar(u, op_dir, t);
+		assert(shift1_var != 0 && shift2_var != 0); // both agents moved, so the shifts exist
 		
 		//cout << "extra swapping conflict at edge (" << v << "," << u << "), timestep " << t << " using shift" << endl;
-		int shift1_var = shift[v][dir].first_varaible + t_ind1;
-		int shift2_var = shift[u][op_dir].first_varaible + t_ind2;
-		AddClause(vector<int> {-shift1_var, -shift2_var});
+		AddClause({-shift1_var, -shift2_var});
 		nr_clauses_conflict++;
 	}
 }
 
 void _MAPFSAT_ISolver::CreateConf_Pebble_At_OnDemand()
 {
+	clause_family = FAMILY_CONFLICT;
 	for (size_t i = 0; i < pebble_conflicts.size(); i++)
 	{
 		int a1, a2, u, v, t;
 		tie(a1, a2, u, v, t) = pebble_conflicts[i];
 
 		//cout << "extra pebble conflict at vertex " << v << ", timestep " << t << " between " << a1 << " and " << a2 << endl;
-		int a1_var = at[a1][v].first_variable + (t - at[a1][v].first_timestep);
-		int a2_var = at[a2][v].first_variable + (t - 1 - at[a2][v].first_timestep);
-		AddClause(vector<int> {-a1_var, -a2_var});
+		int a1_var = At(a1, v).first_variable + (t - At(a1, v).first_timestep);
+		int a2_var = At(a2, v).first_variable + (t - 1 - At(a2, v).first_timestep);
+		AddClause({-a1_var, -a2_var});
 		nr_clauses_conflict++;
 	}
 }
 
 void _MAPFSAT_ISolver::CreateConf_Pebble_Pass_OnDemand()
 {
+	clause_family = FAMILY_CONFLICT;
 	for (size_t i = 0; i < pebble_conflicts.size(); i++)
 	{
 		int a1, a2, v, u, t;
@@ -1243,15 +2490,16 @@ void _MAPFSAT_ISolver::CreateConf_Pebble_Pass_OnDemand()
 		}
 
 		//cout << "extra pebble conflict at edge (" << v << "," << u << "), timestep " << t << " between moving agent " << a1 << " and " << a2 << endl;
-		int a1_var = pass[a1][v][dir].first_variable + (t - pass[a1][v][dir].first_timestep);
-		int a2_var = at[a2][u].first_variable + (t - at[a2][u].first_timestep);
-		AddClause(vector<int> {-a1_var, -a2_var});
+		int a1_var = Pass(a1, v, dir).first_variable + (t - Pass(a1, v, dir).first_timestep);
+		int a2_var = At(a2, u).first_variable + (t - At(a2, u).first_timestep);
+		AddClause({-a1_var, -a2_var});
 		nr_clauses_conflict++;
 	}
 }
 
 void _MAPFSAT_ISolver::CreateConf_Pebble_Shift_OnDemand()
 {
+	clause_family = FAMILY_CONFLICT;
 	for (size_t i = 0; i < pebble_conflicts.size(); i++)
 	{
 		int a1, a2, v, u, t;
@@ -1269,19 +2517,18 @@ void _MAPFSAT_ISolver::CreateConf_Pebble_Shift_OnDemand()
 			}
 		}
 
-		size_t t_ind = find(shift[v][dir].timestep.begin(), shift[v][dir].timestep.end(), t) - shift[v][dir].timestep.begin();
-		int shift1_var = shift[v][dir].first_varaible + t_ind;
+		int shift1_var = ShiftVar(v, dir, t);
+		assert(shift1_var != 0); // the agent moved, so the shift exists
 
 		for (int u_dir = 1; u_dir < 5; u_dir++) // do not check waiting direction
 		{
-			size_t ind = find(shift[u][u_dir].timestep.begin(), shift[u][u_dir].timestep.end(), shift[v][dir].timestep[t_ind]) - shift[u][u_dir].timestep.begin();
+			int shift2_var = ShiftVar(u, u_dir, t);
 
-			if (ind == shift[u][u_dir].timestep.size() || shift[u][u_dir].timestep[ind] != shift[v][dir].timestep[t_ind]) // did not find t in neighboring shift
+			if (shift2_var == 0) // did not find t in neighboring shift
 				continue;
 			
-			//cout << "extra pebble conflict at edge (" << v << "," << u << "), timestep " << shift[v][dir].timestep[t_ind] << " direction " << u_dir << " using shift" << endl;
-			int shift2_var = shift[u][u_dir].first_varaible + ind;
-			AddClause(vector<int> {-shift1_var, -shift2_var});
+			//cout << "extra pebble conflict at edge (" << v << "," << u << "), timestep " << t << " direction " << u_dir << " using shift" << endl;
+			AddClause({-shift1_var, -shift2_var});
 			nr_clauses_conflict++;
 		}
 	}
@@ -1289,6 +2536,7 @@ void _MAPFSAT_ISolver::CreateConf_Pebble_Shift_OnDemand()
 
 void _MAPFSAT_ISolver::CreateConst_Avoid()
 {
+	clause_family = FAMILY_CONFLICT;
 	for (size_t i = 0; i < inst->avoid_locations.size(); i++)
 	{
 		if (inst->avoid_locations[i].t < max_timestep)
@@ -1298,52 +2546,374 @@ void _MAPFSAT_ISolver::CreateConst_Avoid()
 
 			for (int a = 0; a < agents; a++)
 			{
-				if (at[a][v].first_variable == 0)
+				if (At(a, v).first_variable == 0)
+					continue;
+				if (At(a, v).first_timestep > t || At(a, v).last_timestep < t)
 					continue;
 				
-				int at_var = at[a][v].first_variable + (t - at[a][v].first_timestep);
-				AddClause(vector<int> {-at_var});
+				int at_var = At(a, v).first_variable + (t - At(a, v).first_timestep);
+				AddClause({-at_var});
 				nr_clauses_conflict++;
 			}
 		}
 	}
 }
 
+void _MAPFSAT_ISolver::CreateConst_MDD()
+{
+	clause_family = FAMILY_UNIT;
+	for (size_t i = 0; i < mdd_holes.size(); i++)
+	{
+		int a = mdd_holes[i].first / vertices;
+		int v = mdd_holes[i].first % vertices;
+		int t = mdd_holes[i].second;
+
+		//cout << a << " can not be at " << v << ", timestep " << t << " because it is not in its decision diagram" << endl;
+		int at_var = At(a, v).first_variable + (t - At(a, v).first_timestep);
+		AddClause({-at_var});
+		nr_clauses_unit++;
+	}
+}
+
+/****************************/
+// MARK: cnf writer
+/****************************/
+
+_MAPFSAT_CNFWriter::~_MAPFSAT_CNFWriter()
+{
+	Close();
+}
+
+bool _MAPFSAT_CNFWriter::Open(string file)
+{
+	Close();
+	out.open(file, ios::out | ios::trunc | ios::binary);
+	if (!out.is_open())
+		return false;
+
+	clauses = 0;
+	buffer.reserve(buffer_size);
+	out << string(header_width - 1, ' ') << "\n";	// placeholder, see Finish
+	return true;
+}
+
+void _MAPFSAT_CNFWriter::Close()
+{
+	if (!out.is_open())
+		return;
+
+	Flush();
+	out.close();
+	string().swap(buffer);
+}
+
+void _MAPFSAT_CNFWriter::AddLiteral(int lit)
+{
+	*this << lit;
+	buffer += (lit == 0) ? '\n' : ' ';
+	if (lit == 0)
+		clauses++;
+}
+
+_MAPFSAT_CNFWriter& _MAPFSAT_CNFWriter::operator<<(const char* text)
+{
+	buffer += text;
+	if (buffer.size() >= buffer_size)
+		Flush();
+	return *this;
+}
+
+_MAPFSAT_CNFWriter& _MAPFSAT_CNFWriter::operator<<(int number)
+{
+	char digits[12];
+	int nr_digits = 0;
+	unsigned int value = (number < 0) ? -(unsigned int)number : number;
+	do
+	{
+		digits[nr_digits++] = '0' + value % 10;
+		value /= 10;
+	} while (value > 0);
+
+	if (number < 0)
+		buffer += '-';
+	while (nr_digits > 0)
+		buffer += digits[--nr_digits];
+
+	if (buffer.size() >= buffer_size)
+		Flush();
+	return *this;
+}
+
+void _MAPFSAT_CNFWriter::Finish(int vars)
+{
+	Flush();
+
+	// the header is padded by spaces to the reserved width
+	stringstream header;
+	header << "p cnf " << vars << " " << clauses;
+	string line = header.str();
+	line.resize(header_width - 1, ' ');
+
+	out.seekp(0);
+	out << line;
+	out.seekp(0, ios::end);
+	out.flush();
+}
+
+void _MAPFSAT_CNFWriter::Flush()
+{
+	out.write(buffer.data(), buffer.size());
+	buffer.clear();
+}
+
+/****************************/
+// MARK: binary writer
+/****************************/
+
+_MAPFSAT_BinaryWriter::~_MAPFSAT_BinaryWriter()
+{
+	Close();
+}
+
+bool _MAPFSAT_BinaryWriter::Open(string file, string map, string scen, string encoding, int agents, int delta)
+{
+	Close();
+	out.open(file, ios::out | ios::trunc | ios::binary);
+	if (!out.is_open())
+		return false;
+
+	clauses = 0;
+	buffer.reserve(buffer_size);
+	buffer += "MAPFSATB";
+	buffer.append(4, '\0');
+	buffer[8] = 1;	// version
+	buffer.append(12, '\0');	// number of variables and clauses, see Finish
+	WriteVarint(agents);
+	WriteVarint(delta);
+	WriteString(map);
+	WriteString(scen);
+	WriteString(encoding);
+	return true;
+}
+
+void _MAPFSAT_BinaryWriter::Close()
+{
+	if (!out.is_open())
+		return;
+
+	Flush();
+	out.close();
+	string().swap(buffer);
+}
+
+void _MAPFSAT_BinaryWriter::AddLiteral(int lit, int family)
+{
+	if (lit != 0)
+	{
+		clause.push_back(lit);
+		return;
+	}
+
+	WriteRecord(family, clause);
+	clause.clear();
+	clauses++;
+}
+
+void _MAPFSAT_BinaryWriter::Finish(int vars, vector<int>& assumptions)
+{
+	WriteRecord(FAMILY_SOLVE, assumptions);
+	Flush();
+
+	char header[12];
+	for (int i = 0; i < 4; i++)
+		header[i] = (vars >> (8 * i)) & 0xff;
+	for (int i = 0; i < 8; i++)
+		header[4 + i] = (clauses >> (8 * i)) & 0xff;
+
+	out.seekp(12);
+	out.write(header, 12);
+	out.seekp(0, ios::end);
+	out.flush();
+}
+
+void _MAPFSAT_BinaryWriter::WriteRecord(int family, vector<int>& lits)
+{
+	WriteVarint(((unsigned long long)lits.size() << 3) | family);
+	long long previous = 0;
+	for (size_t i = 0; i < lits.size(); i++)
+	{
+		long long diff = lits[i] - previous;
+		WriteVarint((diff < 0) ? ((-diff) << 1) - 1 : diff << 1);	// zigzag
+		previous = lits[i];
+	}
+
+	if (buffer.size() >= buffer_size)
+		Flush();
+}
+
+void _MAPFSAT_BinaryWriter::WriteVarint(unsigned long long value)
+{
+	while (value >= 0x80)
+	{
+		buffer += (char)((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	buffer += (char)value;
+}
+
+void _MAPFSAT_BinaryWriter::WriteString(const string& text)
+{
+	WriteVarint(text.size());
+	buffer += text;
+}
+
+void _MAPFSAT_BinaryWriter::Flush()
+{
+	out.write(buffer.data(), buffer.size());
+	buffer.clear();
+}
+
+/****************************/
+// MARK: arena
+/****************************/
+
+_MAPFSAT_Arena::~_MAPFSAT_Arena()
+{
+	Release();
+}
+
+char* _MAPFSAT_Arena::AllocateBytes(size_t bytes)
+{
+	used = (used + alignment - 1) / alignment * alignment;
+	if (blocks.empty() || used + bytes > capacity)
+	{
+		capacity = max(bytes, block_size);
+		blocks.push_back(new char[capacity]);
+		used = 0;
+	}
+
+	char* memory = blocks.back() + used;
+	used += bytes;
+	return memory;
+}
+
+void _MAPFSAT_Arena::Release()
+{
+	for (size_t i = 0; i < blocks.size(); i++)
+		delete[] blocks[i];
+	blocks.clear();
+	used = 0;
+	capacity = 0;
+}
+
+/****************************/
+// MARK: deadline
+/****************************/
+
+_MAPFSAT_Deadline::_MAPFSAT_Deadline() : end(chrono::time_point<chrono::high_resolution_clock>::max()), cancelled(false)
+{
+}
+
+void _MAPFSAT_Deadline::Reset(int ms, const _MAPFSAT_Deadline* p)
+{
+	end = chrono::high_resolution_clock::now() + chrono::milliseconds(ms);
+	parent = p;
+	cancelled = false;
+}
+
+void _MAPFSAT_Deadline::Cancel()
+{
+	cancelled = true;
+}
+
+bool _MAPFSAT_Deadline::Expired() const
+{
+	// flags first, the clock is read once for the whole chain of parents
+	for (const _MAPFSAT_Deadline* d = this; d != NULL; d = d->parent)
+	{
+		if (d->cancelled)
+			return true;
+	}
+
+	auto now = chrono::high_resolution_clock::now();
+	for (const _MAPFSAT_Deadline* d = this; d != NULL; d = d->parent)
+	{
+		if (now >= d->end)
+			return true;
+	}
+	return false;
+}
+
+int _MAPFSAT_Deadline::Remaining() const
+{
+	if (Expired())
+		return 0;
+
+	auto now = chrono::high_resolution_clock::now();
+	long long remaining = INT_MAX;
+	for (const _MAPFSAT_Deadline* d = this; d != NULL; d = d->parent)
+		remaining = min(remaining, (long long)chrono::duration_cast<chrono::milliseconds>(d->end - now).count());
+	return max(0LL, remaining);
+}
+
 /****************************/
 // MARK: solver functions
 /****************************/
 
-int _MAPFSAT_ISolver::InvokeSolver(int timelimit)
+const _MAPFSAT_TEGAgent _MAPFSAT_ISolver::no_variables = {0, 0, -1};
+
+thread_local _MAPFSAT_ClauseBuffer* _MAPFSAT_ISolver::clause_buffer = NULL;
+
+void _MAPFSAT_ISolver::AddClause(initializer_list<int> clause)
+{
+	AddClause(clause.begin(), clause.size());
+}
+
+void _MAPFSAT_ISolver::AddClause(const vector<int>& clause)
 {
-	if (cnf_file.compare("") != 0)	// print cnf into file
+	AddClause(clause.data(), clause.size());
+}
+
+void _MAPFSAT_ISolver::AddClause(const int* clause, int size)
+{
+	if (clause_buffer != NULL)	// called from a worker thread, solver is filled later
 	{
-		std::ofstream out(cnf_file);
-		if (out.is_open())
-		{
-			out << "p cnf " << nr_vars-1 << " " << nr_clauses << endl;
-			out << cnf_printable.str() << endl;
-			out.close();
-		}
+		clause_buffer->literals.insert(clause_buffer->literals.end(), clause, clause + size);
+		clause_buffer->literals.push_back(0);
+		clause_buffer->clauses++;
+		return;
 	}
 
+	nr_clauses++;
+	for (int i = 0; i < size; i++)
+		AddLiteral(clause[i]);
+	AddLiteral(0);
+}
+
+int _MAPFSAT_ISolver::InvokeSolver()
+{
+	if (cnf_writer.IsOpen())	// complete cnf_file, clauses are already written
+		cnf_writer.Finish(nr_vars-1);
+	if (binary_writer.IsOpen())
+		binary_writer.Finish(nr_vars-1, assumptions);
+
 	// save memory for SAT solver unless variables are still needed
-	if (!print_plan && !keep_plan && lazy_const != 2)
+	if (!print_plan && !keep_plan && lazy_const != 2 && !IncrementalHorizon())
 	{
 		CleanUp();
-		cnf_printable.clear();
 	}
 
 	int res = -1;
 	plan.clear();
 
-	res = InvokeSolverImplementation(timelimit); // CaDiCaL or monosat
+	res = InvokeSolverImplementation(); // CaDiCaL, Kissat or monosat, bounded by deadline
 
 	// find conflicts if lazy encoding is used
 	if (!plan.empty() && lazy_const == 2)
 		GenerateConflicts();
 
-	// print found plan
-	if (!plan.empty() && print_plan && !conflicts_present)
+	// print found plan, galloping search prints the best plan at its end
+	if (!plan.empty() && print_plan && !conflicts_present && !binary_search)
 		PrintPlan();
 
 	solver_calls++;
@@ -1400,25 +2970,26 @@ void _MAPFSAT_ISolver::PrintPlan()
 
 void _MAPFSAT_ISolver::VerifyPlan()
 {
-	for (size_t a1 = 0; a1 < plan.size(); a1++)
+	vector<tuple<int,int,int,int> > vertex_found;
+	vector<tuple<int,int,int,int,int> > swap_found;
+	vector<tuple<int,int,int,int,int> > pebble_found;
+	FindConflicts(vertex_found, swap_found, pebble_found);
+
+	int a1, a2, v, u, t;
+	for (size_t i = 0; i < vertex_found.size(); i++)
 	{
-		for (size_t a2 = a1+1; a2 < plan.size(); a2++)
-		{
-			for (size_t t = 0; t < plan[a1].size(); t++)
-			{
-				if (plan[a1][t] == plan[a2][t])
-					cout << "Vertex conflict! Agents " << a1 << ", " << a2 << ", timestep " << t << ", location " << plan[a1][t] << endl;
-				
-				if (t < plan[a1].size() - 1 && plan[a1][t] == plan[a2][t+1] && plan[a1][t+1] == plan[a2][t])
-					cout << "Swapping conflict! Agents " << a1 << ", " << a2 << ", timestep " << t << ", edge (" << plan[a1][t] << "," << plan[a1][t+1] << ")" << endl;
-				
-				if (movement == 2 && t < plan[a1].size() - 1 && plan[a1][t] == plan[a2][t+1])
-					cout << "Pebble conflict! Agent " << a2 << " moved into " << plan[a2][t+1] << " in " << t+1 << ", but " << a1 << " was present in previous timestep." << endl;
-				
-				if (movement == 2 && t < plan[a1].size() - 1 && plan[a1][t+1] == plan[a2][t])
-					cout << "Pebble conflict! Agent " << a1 << " moved into " << plan[a1][t+1] << " in " << t+1 << ", but " << a2 << " was present in previous timestep." << endl;
-			}
-		}
+		tie(a1, a2, v, t) = vertex_found[i];
+		cout << "Vertex conflict! Agents " << a1 << ", " << a2 << ", timestep " << t << ", location " << v << endl;
+	}
+	for (size_t i = 0; i < swap_found.size(); i++)
+	{
+		tie(a1, a2, v, u, t) = swap_found[i];
+		cout << "Swapping conflict! Agents " << a1 << ", " << a2 << ", timestep " << t << ", edge (" << v << "," << u << ")" << endl;
+	}
+	for (size_t i = 0; i < pebble_found.size(); i++)
+	{
+		tie(a1, a2, v, u, t) = pebble_found[i];
+		cout << "Pebble conflict! Agent " << a1 << " moved into " << u << " in " << t << ", but " << a2 << " was present in previous timestep." << endl;
 	}
 }
 
@@ -1430,57 +3001,104 @@ vector<vector<int> > _MAPFSAT_ISolver::GetPlan()
 void _MAPFSAT_ISolver::GenerateConflicts()
 {
 	// add only new conflict, old conflict are already in the SAT solver
-	vertex_conflicts.clear();
-	swap_conflicts.clear();
-	pebble_conflicts.clear();
+	if (FindConflicts(vertex_conflicts, swap_conflicts, pebble_conflicts))
+		conflicts_present = true;
+}
+
+bool _MAPFSAT_ISolver::FindConflicts(vector<tuple<int,int,int,int> >& vertex_found, vector<tuple<int,int,int,int,int> >& swap_found, vector<tuple<int,int,int,int,int> >& pebble_found)
+{
+	vertex_found.clear();
+	swap_found.clear();
+	pebble_found.clear();
+	if (plan.empty())
+		return false;
+
+	int ags = plan.size();
+	int timesteps = plan[0].size();
+	int slots = inst->number_of_vertices + 1;	// the last slot holds the agents without a position (-1)
+	if ((int)occupancy_head.size() < slots)
+	{
+		occupancy_epoch.resize(slots, 0);
+		occupancy_head.resize(slots);
+	}
+	occupancy_next.resize(ags);
+	if (epoch > INT_MAX - timesteps)
+	{
+		fill(occupancy_epoch.begin(), occupancy_epoch.end(), 0);
+		epoch = 0;
+	}
 
-	for (size_t a1 = 0; a1 < plan.size(); a1++)
+	for (int t = 0; t < timesteps; t++)
 	{
-		for (size_t a2 = a1+1; a2 < plan.size(); a2++)
+		// chain the agents by their vertex at t, the agents already in the chain are in a vertex conflict
+		epoch++;
+		for (int a = 0; a < ags; a++)
 		{
-			for (size_t t = 0; t < plan[a1].size(); t++)
+			int v = (plan[a][t] < 0) ? slots - 1 : plan[a][t];
+			if (occupancy_epoch[v] != epoch)
 			{
-				if (plan[a1][t] == plan[a2][t])
-				{
-					conflicts_present = true;
-					vertex_conflicts.push_back(make_tuple(a1,a2,plan[a1][t],t));
-					//cout << "Vertex conflict! Agents " << a1 << ", " << a2 << ", timestep " << t << ", location " << plan[a1][t] << endl;
-				}
-				
-				if (t < plan[a1].size() - 1 && plan[a1][t] == plan[a2][t+1] && plan[a1][t+1] == plan[a2][t] && plan[a1][t] != plan[a2][t])
-				{
-					conflicts_present = true;
-					swap_conflicts.push_back(make_tuple(a1,a2,plan[a1][t],plan[a1][t+1],t));
-					//cout << "Swapping conflict! Agents " << a1 << ", " << a2 << ", timestep " << t << ", edge (" << plan[a1][t] << "," << plan[a1][t+1] << ")" << endl;
-				}
+				occupancy_epoch[v] = epoch;
+				occupancy_head[v] = -1;
+			}
+			for (int b = occupancy_head[v]; b != -1; b = occupancy_next[b])
+				vertex_found.push_back(make_tuple(b, a, plan[a][t], t));
+			occupancy_next[a] = occupancy_head[v];
+			occupancy_head[v] = a;
+		}
 
-				if (movement == 2 && t < plan[a1].size() - 1 && plan[a1][t] == plan[a2][t+1] && plan[a2][t] != plan[a2][t+1])
-				{
-					conflicts_present = true;
-					pebble_conflicts.push_back(make_tuple(a2,a1,plan[a2][t],plan[a2][t+1],t+1));
-					//cout << "Pebble conflict! Agent " << a2 << " moved into " << plan[a2][t+1] << " in " << t+1 << ", but " << a1 << " was present in previous timestep." << endl;
-				}
+		if (t + 1 == timesteps)
+			break;
 
-				if (movement == 2 && t < plan[a1].size() - 1 && plan[a1][t+1] == plan[a2][t] && plan[a1][t] != plan[a1][t+1])
-				{
-					conflicts_present = true;
-					pebble_conflicts.push_back(make_tuple(a1,a2,plan[a1][t],plan[a1][t+1],t+1));
-					//cout << "Pebble conflict! Agent " << a1 << " moved into " << plan[a1][t+1] << " in " << t+1 << ", but " << a2 << " was present in previous timestep." << endl;
-				}
+		// an agent moving from v to u swaps with the agents at u moving to v, pebble motion forbids entering u with any agent at u
+		for (int a = 0; a < ags; a++)
+		{
+			int v = plan[a][t];
+			int u = plan[a][t+1];
+			int u_slot = (u < 0) ? slots - 1 : u;
+			if (v == u || occupancy_epoch[u_slot] != epoch)
+				continue;
+
+			for (int b = occupancy_head[u_slot]; b != -1; b = occupancy_next[b])
+			{
+				if (a < b && plan[b][t+1] == v)
+					swap_found.push_back(make_tuple(a, b, v, u, t));
+				if (movement == 2)
+					pebble_found.push_back(make_tuple(a, b, v, u, t+1));
 			}
 		}
 	}
+
+	// keep the order of a scan over pairs of agents and then timesteps, so the formula does not change
+	sort(vertex_found.begin(), vertex_found.end(), [](const tuple<int,int,int,int>& x, const tuple<int,int,int,int>& y)
+	{
+		return make_tuple(get<0>(x), get<1>(x), get<3>(x)) < make_tuple(get<0>(y), get<1>(y), get<3>(y));
+	});
+	sort(swap_found.begin(), swap_found.end(), [](const tuple<int,int,int,int,int>& x, const tuple<int,int,int,int,int>& y)
+	{
+		return make_tuple(get<0>(x), get<1>(x), get<4>(x)) < make_tuple(get<0>(y), get<1>(y), get<4>(y));
+	});
+	sort(pebble_found.begin(), pebble_found.end(), [](const tuple<int,int,int,int,int>& x, const tuple<int,int,int,int,int>& y)
+	{
+		// the pair is ordered, the agent with the higher index moving is first
+		return make_tuple(min(get<0>(x), get<1>(x)), max(get<0>(x), get<1>(x)), get<4>(x), get<0>(x) < get<1>(x))
+			< make_tuple(min(get<0>(y), get<1>(y)), max(get<0>(y), get<1>(y)), get<4>(y), get<0>(y) < get<1>(y));
+	});
+
+	return !vertex_found.empty() || !swap_found.empty() || !pebble_found.empty();
 }
 
 /****************************/
 // MARK: cleanup functions
 /****************************/
 
-bool _MAPFSAT_ISolver::TimesUp(	std::chrono::time_point<std::chrono::high_resolution_clock> start_time,
-						std::chrono::time_point<std::chrono::high_resolution_clock> current_time,
-						int timelimit) // timelimit is in ms
+bool _MAPFSAT_ISolver::IncrementalHorizon()
 {
-	if (chrono::duration_cast<chrono::milliseconds>(current_time - start_time).count() > timelimit)
+	return (incremental_window > 0 && solver_to_use == 1);
+}
+
+bool _MAPFSAT_ISolver::TimesUp()
+{
+	if (deadline.Expired())
 	{
 		CleanUp();
 		ReleaseSolver();
@@ -1491,43 +3109,15 @@ bool _MAPFSAT_ISolver::TimesUp(	std::chrono::time_point<std::chrono::high_resolu
 
 void _MAPFSAT_ISolver::CleanUp()
 {
-	if (shift != NULL)
-	{
-		for (int v = 0; v < vertices; v++)
-			delete[] shift[v];
-		delete[] shift;
-		shift = NULL;
-	}
-
-	if (shift_times_start != NULL)
-	{
-		delete[] shift_times_start;
-		shift_times_start = NULL;
-	}
-
-	if (shift_times_end != NULL)
-	{
-		delete[] shift_times_end;
-		shift_times_end = NULL;
-	}
-
-	if (pass != NULL)
-	{
-		for (int a = 0; a < agents; a++)
-		{
-			for (int v = 0; v < vertices; v++)
-				delete[] pass[a][v];
-			delete[] pass[a];
-		}
-		delete[] pass;
-		pass = NULL;
-	}
+	horizon_lits.clear();
 
-	if (at != NULL)
-	{
-		for (int a = 0; a < agents; a++)
-			delete[] at[a];
-		delete[] at;
-		at = NULL;
-	}
+	teg_arena.Release();
+	at_index = _MAPFSAT_TEGIndex();
+	pass_index = _MAPFSAT_TEGIndex();
+	shift_index = _MAPFSAT_ShiftIndex();
+	shift_times_start = NULL;
+	shift_times_end = NULL;
+	mdd_first = NULL;
+	mdd_last = NULL;
+	vector<pair<int,int> >().swap(mdd_holes);
 }
\ No newline at end of file
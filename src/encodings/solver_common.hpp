@@ -5,8 +5,14 @@
 #include <chrono>
 #include <thread>
 #include <unordered_map>
+#include <map>
 #include <tuple>
 #include <cassert>
+#include <initializer_list>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <climits>
 
 #include "../instance.hpp"
 #include "../logger.hpp"
@@ -18,10 +24,149 @@ struct _MAPFSAT_TEGAgent
 	int last_timestep;
 };
 
+struct _MAPFSAT_Timesteps
+{
+	const int* first;
+	const int* last;
+
+	const int* begin() const { return first; }
+	const int* end() const { return last; }
+	size_t size() const { return last - first; }
+	int operator[](size_t i) const { return first[i]; }
+};
+
 struct _MAPFSAT_Shift
 {
 	int first_varaible;
-	std::vector<int> timestep;
+	_MAPFSAT_Timesteps timestep;
+};
+
+// at and pass variables in CSR form, only (agent, vertex) pairs with a non-empty time window have an entry
+struct _MAPFSAT_TEGIndex
+{
+	int* row_start = NULL;	// entries of row a * vertices + v start at row_start[row], the last row ends at row_start[agents * vertices]
+	unsigned char* dirs = NULL;	// pass only, bit dir is set if the row has an entry for direction dir
+	_MAPFSAT_TEGAgent* entries = NULL;
+};
+
+// shift variables in CSR form, one row per vertex and direction
+struct _MAPFSAT_ShiftIndex
+{
+	int* row_start = NULL;	// timesteps of row v * 5 + dir start at row_start[row]
+	int* timesteps = NULL;
+	int first_variable = 0;	// variable of the i-th timestep is first_variable + i
+	int* window_start = NULL;	// window of row covers its first to last timestep, starts at window_start[row]
+	int* window = NULL;	// variable of timestep t in the window, 0 if there is none
+};
+
+// writes the formula into a file while it is generated, the header is patched once the formula is complete
+class _MAPFSAT_CNFWriter
+{
+public:
+	~_MAPFSAT_CNFWriter();
+
+	bool Open(std::string);	// truncates the file and reserves space for the header
+	void Close();
+	bool IsOpen() const { return out.is_open(); }
+
+	void AddLiteral(int);	// 0 ends the clause
+	_MAPFSAT_CNFWriter& operator<<(const char*);
+	_MAPFSAT_CNFWriter& operator<<(int);
+	void Finish(int);	// writes the header with the given number of variables, the file stays open for more clauses
+
+private:
+	static const size_t buffer_size = 1 << 20;
+	static const int header_width = 48;
+	std::ofstream out;
+	std::string buffer;
+	long long clauses = 0;
+
+	void Flush();
+};
+
+// clause families as counted in nr_clauses_*, stored with each clause of the binary formula
+enum _MAPFSAT_ClauseFamily
+{
+	FAMILY_UNIT = 0,
+	FAMILY_MOVE = 1,
+	FAMILY_DUPLI = 2,
+	FAMILY_CONFLICT = 3,
+	FAMILY_SOC = 4,
+	FAMILY_SOLVE = 7	// not a clause, solver call under the stored assumptions
+};
+
+// writes the formula in a binary form, replayed by _MAPFSAT_SAT::ReplayFormula
+// header: "MAPFSATB", version, number of variables and clauses (fixed width, little endian), agents, delta, map, scenario and encoding (varints and strings)
+// records: varint of (size << 3 | family) followed by size literals, the first as a zigzag varint, the others as zigzag varints of the difference to the previous one
+class _MAPFSAT_BinaryWriter
+{
+public:
+	~_MAPFSAT_BinaryWriter();
+
+	bool Open(std::string, std::string, std::string, std::string, int, int);	// file, map, scenario, encoding, agents, delta
+	void Close();
+	bool IsOpen() const { return out.is_open(); }
+
+	void AddLiteral(int, int);	// literal and its clause family, 0 ends the clause
+	void Finish(int, std::vector<int>&);	// records a solver call with the given assumptions and writes the number of variables into the header
+
+private:
+	static const size_t buffer_size = 1 << 20;
+	std::ofstream out;
+	std::string buffer;
+	std::vector<int> clause;
+	long long clauses = 0;
+
+	void WriteRecord(int, std::vector<int>&);
+	void WriteVarint(unsigned long long);
+	void WriteString(const std::string&);
+	void Flush();
+};
+
+// bump allocator, everything allocated is freed at once by Release
+class _MAPFSAT_Arena
+{
+public:
+	~_MAPFSAT_Arena();
+
+	template <typename T>
+	T* Allocate(size_t count) { return reinterpret_cast<T*>(AllocateBytes(count * sizeof(T))); }
+	void Release();
+
+private:
+	static const size_t block_size = 1 << 20;
+	static const size_t alignment = 16;
+	std::vector<char*> blocks;
+	size_t used = 0;
+	size_t capacity = 0;
+
+	char* AllocateBytes(size_t);
+};
+
+// deadline and cancellation of a solve, cheap enough to be polled inside the constraint generators and by the SAT solvers
+// a deadline expires with its parent, so a solver started by another solver never outlives it
+class _MAPFSAT_Deadline
+{
+public:
+	_MAPFSAT_Deadline();
+
+	void Reset(int, const _MAPFSAT_Deadline* = NULL);	// expires in the given number of ms or with the parent, clears the cancellation
+	void Cancel();	// expires now, thread safe
+	bool Expired() const;	// thread safe
+	int Remaining() const;	// in ms, 0 once expired
+
+private:
+	std::chrono::time_point<std::chrono::high_resolution_clock> end;
+	std::atomic<bool> cancelled;
+	const _MAPFSAT_Deadline* parent = NULL;
+};
+
+struct _MAPFSAT_ClauseBuffer
+{
+	std::vector<int> literals; // clauses separated by 0
+	long long clauses = 0;
+	int last_lit = 0;
+	bool done = false;
 };
 
 class _MAPFSAT_ISolver
@@ -62,6 +207,96 @@ public:
     */
 	std::vector<std::vector<int> > GetPlan();
 
+	/** Keep one solver alive across delta increments.
+    * 
+    * Only CaDiCaL is supported. The formula is built for delta + window at once and the current delta is enforced by assumptions, so learned clauses are kept between the calls.
+    * For makespan, timesteps past the current bound are closed off. For sum of costs, the delays are counted by a totalizer and its outputs are assumed false.
+    *
+    * @param window number of delta increments covered by a single formula. 0 = rebuild the formula for every delta. Default is 0.
+    */
+	void SetIncremental(int);
+
+	/** Set the number of threads building the formula.
+    * 
+    * The largest constraint families are split into chunks built in parallel. The chunks are merged in order, so the formula does not depend on the number of threads.
+    *
+    * @param threads number of worker threads. Default is 1.
+    */
+	void SetThreads(int);
+
+	/** Set the encoding of eager vertex conflicts.
+    * 
+    * Pairwise forbids each pair of agents at a vertex at the same timestep. Other encodings put one at-most-one constraint over all agents that can be at a vertex at a timestep. Conflicts added on demand are always pairwise.
+    *
+    * @param amo 0 = pairwise, 1 = sequential counter, 2 = commander, 3 = product. Default is 0.
+    */
+	void SetVertexAMO(int);
+
+	/** Store the solved formulas in a binary form.
+    * 
+    * Each new formula overwrites the file. Solver calls and their assumptions are recorded as well, so the formula can be solved again by _MAPFSAT_SAT::ReplayFormula. Only CaDiCaL encodings are stored.
+    *
+    * @param binary_file file to store the formula in. Default is "", ie. do not store.
+    */
+	void SetBinaryFile(std::string);
+
+	/** Prune the time expanded graph before creating variables.
+    * 
+    * A multi-valued decision diagram of each agent keeps only the positions reachable from its start and leading to its goal, avoiding the goals of other agents once they are reached and the avoided locations.
+    * The window of an agent at a vertex is cut to the positions in the diagram, positions inside the window not in the diagram are forbidden by unit clauses. Only CaDiCaL and Kissat encodings are pruned.
+    *
+    * @param mdd option to prune. Default is false.
+    */
+	void SetMDD(bool);
+
+	/** Encode swapping conflicts inside corridors of the map by direction variables.
+    * 
+    * Each edge of a corridor found by _MAPFSAT_Instance gets a direction variable per timestep, moving along the edge implies the direction and moving against it implies its negation. This replaces the pairwise swapping clauses of all agents passing through the edge, if it needs fewer clauses. Only CaDiCaL and Kissat encodings with parallel motion and at or pass variables use the corridors.
+    *
+    * @param corridors option to use the corridors. Default is false.
+    */
+	void SetCorridors(bool);
+
+	/** Solve groups of agents that do not interact by separate solvers.
+    * 
+    * Every agent starts in its own group on a shortest path. For a pair of groups in conflict, one and then the other group is replanned with the same cost avoiding the paths of all other groups. If the pair is still in conflict, the groups are merged and solved optimally.
+    * Replanning avoids only the vertices of the other paths in each timestep, swaps with them are not avoided and count as conflicts of the next round.
+    * Solve returns the result of the first group without a plan, -1 if it has no solution and 1 on timeout.
+    * Each group is solved by a new solver of the same encoding and settings, the threads set by SetThreads solve several groups at once. This repeats until the paths of all groups are free of conflicts, the combined plan is optimal since every group is.
+    * The delta of Solve is not used. Oneshot solving and avoided locations always use a single formula.
+    *
+    * @param independence option to detect independent groups. Default is false.
+    */
+	void SetIndependenceDetection(bool);
+
+	/** Raise the first delta by lower bounds from cardinal conflicts of pairs of agents.
+    *  
+    * The bounds are computed by GetConflictMksLB or GetConflictSocLB of _MAPFSAT_Instance before the first solver call and reported by the logger next to the trivial bounds. The delta of Solve is used if it is higher. Not used for oneshot solving and with avoided locations.
+    *
+    * @param bounds option to compute the bounds. Default is false.
+    */
+	void SetConflictBounds(bool);
+
+	/** Set how the delta is searched after the first solver call.
+    *  
+    * Linear search adds one to delta after each unsat call. Galloping search adds 1, 2, 4, ... until the first sat call and then halves the interval between the highest unsat and the lowest sat delta, the plan and statistics of the lowest sat delta are kept.
+    * A timeout during galloping search is still reported as a timeout. If a sat call was done, GetPlan returns the plan of the lowest sat delta, its cost is only an upper bound.
+    * A known cost of a solution seeds the sat end of the interval. If no sat call confirms it, the search continues above it. Galloping search is not used for oneshot solving and with incremental windows.
+    *
+    * @param strategy 0 = linear, 1 = galloping and binary search. Default is 0.
+    * @param upper_bound makespan or sum of costs of a known solution, used by the next solve call only. -1 = no bound. Default is -1.
+    */
+	void SetDeltaSearch(int, int = -1);
+
+	/** Solve each delta by a portfolio of encodings in parallel.
+    *  
+    * A solver of this encoding and the given solvers build and solve the same delta, each on its own thread. The first definitive sat or unsat answer is used, the other solvers are cancelled. The winning encoding of each call is printed and logged.
+    * All solvers get the settings of this solver. Only CaDiCaL and Kissat encodings with the same cost function and motion may be combined. Delta is searched linearly, independence detection takes precedence.
+    *
+    * @param solvers solvers of the other encodings without data, they are owned by this solver.
+    */
+	void SetPortfolio(std::vector<_MAPFSAT_ISolver*>);
+
 protected:
 	_MAPFSAT_Instance* inst;
 	_MAPFSAT_Logger* log;
@@ -76,21 +311,43 @@ protected:
 	bool print_plan;
 	bool use_avoid;
 	bool keep_plan;
-	int solver_to_use = 1; // 1 = CaDiCaL, 2 = monosat
+	int solver_to_use = 1; // 1 = CaDiCaL, 2 = monosat, 3 = Kissat
 	int duplicates; // 1 = forbid, 2 = allow
+	int incremental_window = 0; // 0 = rebuild formula for each delta
+	int threads = 1; // number of threads building the formula
+	int vertex_amo = 0; // 0 = pairwise, 1 = sequential, 2 = commander, 3 = product
+	bool mdd_pruning = false; // cut the windows of agents by their decision diagrams
+	bool corridor_conflicts = false; // swapping conflicts inside corridors use direction variables
+	bool independence_detection = false; // solve independent groups of agents by separate solvers
+	bool conflict_bounds = false; // start from lower bounds raised by cardinal conflicts
+	int delta_search = 0; // 0 = linear, 1 = galloping and binary search
+	int upper_bound = -1; // cost of a known solution for the next solve call, -1 = none
+	bool binary_search = false; // the current solve call searches the delta, plans are printed at its end
+	std::vector<std::unique_ptr<_MAPFSAT_ISolver> > portfolio; // solvers of all encodings of the portfolio, this encoding first, empty = no portfolio
+	_MAPFSAT_Deadline deadline; // of the current solve call, checked by the generators and the SAT solvers
+	const _MAPFSAT_Deadline* outer_deadline = NULL; // deadline of the solver that started this one, cancelled by the portfolio once another solver answered
 
 	int agents;
 	int vertices;
 	int delta;
 	int max_timestep;
-	std::stringstream cnf_printable;
-
-	_MAPFSAT_TEGAgent** at;
-	_MAPFSAT_TEGAgent*** pass;
-	_MAPFSAT_Shift** shift;
+	int horizon_delta; // largest delta covered by the current formula, equals delta unless solving incrementally
+	_MAPFSAT_CNFWriter cnf_writer; // streams the formula into cnf_file
+	std::string binary_file;
+	_MAPFSAT_BinaryWriter binary_writer; // streams the formula into binary_file, CaDiCaL only
+	int clause_family = FAMILY_UNIT; // family of the clauses being generated
+
+	_MAPFSAT_Arena teg_arena;	// holds the index of all variables, released in CleanUp
+	_MAPFSAT_TEGIndex at_index;
+	_MAPFSAT_TEGIndex pass_index;
+	_MAPFSAT_ShiftIndex shift_index;
+	static const _MAPFSAT_TEGAgent no_variables;	// returned for empty windows, first_variable is 0
 	int* shift_times_start;
 	int* shift_times_end;
 	int at_vars;
+	int* mdd_first = NULL;	// window of agent a at vertex v cut by its decision diagram, indexed by a * vertices + v, NULL if not pruned
+	int* mdd_last = NULL;
+	std::vector<std::pair<int,int> > mdd_holes;	// (a * vertices + v, t) inside the cut window but not in the diagram
 
 	int nr_vars;
 	long long nr_clauses;
@@ -110,16 +367,107 @@ protected:
 	std::vector<std::tuple<int,int,int,int,int> > swap_conflicts;
 	std::vector<std::tuple<int,int,int,int,int> > pebble_conflicts;
 
+	// conflict detection, the agents at a vertex in the current timestep are chained from occupancy_head
+	std::vector<int> occupancy_epoch; // occupancy_head of a vertex is valid only if it was set in the current epoch
+	std::vector<int> occupancy_head;
+	std::vector<int> occupancy_next; // next agent at the same vertex, -1 ends the chain
+	int epoch = 0; // one epoch per timestep, the tables are never cleared
+
+	// incremental solving
+	std::vector<int> horizon_lits; // horizon_lits[i] is true if the cost is larger than LB + horizon_start + i
+	int horizon_start;
+	std::vector<int> assumptions;
+
 	// solver
 	void* SAT_solver;
 
 	// before solving
-	void PrintSolveDetails(int);
+	void PrintSolveDetails();
 
 	// virtual encoding to be used
-	virtual int CreateFormula(int) = 0;
+	virtual int CreateFormula() = 0;
+	virtual _MAPFSAT_ISolver* NewSolver() = 0; // solver of the same encoding, without data and settings
+
+	// independence detection
+	int SolveIndependent(int, bool);
+	bool FindGroupConflicts(const std::vector<int>&, std::vector<std::pair<int,int> >&);
+
+	// portfolio
+	int SolvePortfolio(long long, bool);
+
+	// variable index lookup
+	const _MAPFSAT_TEGAgent& At(int a, int v) const
+	{
+		int row = a * vertices + v;
+		if (at_index.row_start[row] == at_index.row_start[row + 1])
+			return no_variables;
+		return at_index.entries[at_index.row_start[row]];
+	}
+
+	const _MAPFSAT_TEGAgent& Pass(int a, int v, int dir) const
+	{
+		int row = a * vertices + v;
+		unsigned char dirs = pass_index.dirs[row];
+		if (!(dirs & (1 << dir)))
+			return no_variables;
+		return pass_index.entries[pass_index.row_start[row] + __builtin_popcount(dirs & ((1 << dir) - 1))];
+	}
+
+	_MAPFSAT_Shift Shift(int v, int dir) const
+	{
+		int row = v * 5 + dir;
+		_MAPFSAT_Shift s = {shift_index.first_variable + shift_index.row_start[row], {shift_index.timesteps + shift_index.row_start[row], shift_index.timesteps + shift_index.row_start[row + 1]}};
+		return s;
+	}
+
+	int ShiftVar(int v, int dir, int t) const	// 0 if there is no shift variable
+	{
+		int row = v * 5 + dir;
+		if (shift_index.row_start[row] == shift_index.row_start[row + 1])
+			return 0;
+		int offset = t - shift_index.timesteps[shift_index.row_start[row]];
+		if (offset < 0 || offset >= shift_index.window_start[row + 1] - shift_index.window_start[row])
+			return 0;
+		return shift_index.window[shift_index.window_start[row] + offset];
+	}
+
+	// window of agent a at vertex v before the variables are created
+	int WindowFirst(int a, int v) const
+	{
+		if (mdd_first != NULL)
+			return mdd_first[a * vertices + v];
+		return inst->FirstTimestep(a, v);
+	}
+
+	int WindowLast(int a, int v, int timesteps) const
+	{
+		if (mdd_last != NULL)
+			return mdd_last[a * vertices + v];
+		return inst->LastTimestep(a, v, timesteps, horizon_delta, cost_function);
+	}
+
+	// edge (v,u) has a cell of a corridor, its swapping conflicts are created by CreateConf_Swapping_Corridor
+	bool CorridorEdge(int v, int u) const
+	{
+		if (!corridor_conflicts || solver_to_use == 2)
+			return false;
+		return inst->corridor_of[v] != -1 || inst->corridor_of[u] != -1;
+	}
+
+	// parallel formula building
+	typedef int (_MAPFSAT_ISolver::*RangeGenerator)(int, int, int);
+	static thread_local _MAPFSAT_ClauseBuffer* clause_buffer; // set in worker threads, clauses are collected instead of added to the solver
+	int CreateSharded(int, RangeGenerator, int);
+	int CreateConf_Vertex_Range(int, int, int);
+	int CreateConf_Vertex_AMO_Range(int, int, int);
+	int CreateConf_Swapping_At_Range(int, int, int);
+	int CreateConf_Swapping_Corridor_Range(int, int, int);
+	int CreateConf_Pebble_At_Range(int, int, int);
+	int CreateMove_NoDuplicates_Range(int, int, int);
+	int CreateMove_NextVertex_At_Range(int, int, int);
 
 	// creating formula
+	void CreateMDD(int);
 	int CreateAt(int, int);
 	int CreatePass(int, int);
 	int CreateShift(int, int);
@@ -129,10 +477,11 @@ protected:
 	void CreatePossition_NoneAtGoal();
 	void CreatePossition_NoneAtGoal_Shift();
 
-	void CreateConf_Vertex();
+	int CreateConf_Vertex(int);
 	void CreateConf_Swapping_At();
 	void CreateConf_Swapping_Pass();
 	void CreateConf_Swapping_Shift();
+	int CreateConf_Swapping_Corridor(int);
 	void CreateConf_Pebble_At();
 	void CreateConf_Pebble_Pass();
 	void CreateConf_Pebble_Shift();
@@ -157,23 +506,34 @@ protected:
 	int CreateConst_LimitSoc(int);
 	int CreateConst_LimitSoc_AllAt(int);
 	int CreateConst_LimitSoc_Shift(int);
+	int CreateConst_LimitLate(std::vector<int>&, int);
+	int CreateTotalizer(std::vector<int>&, int, std::vector<int>&, int);
+	int CreateAMO_Sequential(std::vector<int>&, int);
+	int CreateConst_LimitMks(int);
+	void CreateAssumptions();
 	void CreateConst_Avoid();
+	void CreateConst_MDD();
 
 	// solver functions
-	virtual void AddClause(std::vector<int>) = 0;
+	void AddClause(std::initializer_list<int>);
+	void AddClause(const std::vector<int>&);
+	void AddClause(const int*, int);
+	virtual void AddLiteral(int) = 0; // clause sink, 0 ends the clause
 	virtual void CreateSolver() = 0;
 	virtual void ReleaseSolver() = 0;
-	int InvokeSolver(int);
-	virtual int InvokeSolverImplementation(int) = 0;
+	int InvokeSolver();
+	virtual int InvokeSolverImplementation() = 0;
 
 	// plan outputting functions
 	int NormalizePlan();
 	void PrintPlan();
 	void VerifyPlan();
 	void GenerateConflicts();
+	bool FindConflicts(std::vector<std::tuple<int,int,int,int> >&, std::vector<std::tuple<int,int,int,int,int> >&, std::vector<std::tuple<int,int,int,int,int> >&);
 
 	// cleanup functions
-	bool TimesUp(std::chrono::time_point<std::chrono::high_resolution_clock>, std::chrono::time_point<std::chrono::high_resolution_clock>, int);
+	bool IncrementalHorizon();
+	bool TimesUp();
 	void CleanUp();
 };
 
@@ -186,31 +546,65 @@ class _MAPFSAT_SAT : public _MAPFSAT_ISolver
 public:
 	_MAPFSAT_SAT(int, int, int, int, int, int solver = 1, std::string name = "SAT_encoding");
 	~_MAPFSAT_SAT() {};
+
+	/** Solve a formula stored by SetBinaryFile.
+    *
+    * The file is memory mapped and fed into a fresh CaDiCaL without building the formula. Each recorded solver call is repeated with its assumptions.
+    *
+    * @param binary_file file with the stored formula.
+    * @param timeout timeout for all solver calls in seconds.
+    * @param quiet suppress the printing of the results.
+    * @return 0 = the last call is sat, 1 = unsat or timeout, -1 = the file could not be read.
+    */
+	static int ReplayFormula(std::string, int, bool = false);
+protected:
+	void CreatePlan();
+	virtual int Value(int); // value of a variable in the found assignment, positive if true
+
 private:
-	int CreateFormula(int);
+	int CreateFormula();
+	_MAPFSAT_ISolver* NewSolver();
 
-	void AddClause(std::vector<int>);
+	void AddLiteral(int);
 	void CreateSolver();
 	void ReleaseSolver();
-	int InvokeSolverImplementation(int);
+	int InvokeSolverImplementation();
 
 	// specialized functions
-	static void WaitForTerminate(int, void*, bool&);
 	int GetNextVertex(int, int, int);
 };
 
+class _MAPFSAT_Kissat : public _MAPFSAT_SAT
+{
+public:
+	_MAPFSAT_Kissat(int, int, int, int, int, int solver = 3, std::string name = "Kissat_encoding");
+	~_MAPFSAT_Kissat() {};
+private:
+	_MAPFSAT_ISolver* NewSolver();
+
+	void AddLiteral(int);
+	void CreateSolver();
+	void ReleaseSolver();
+	int InvokeSolverImplementation();
+	int Value(int);
+
+	// specialized functions
+	static int Terminate(void*);
+};
+
 class _MAPFSAT_SMT : public _MAPFSAT_ISolver
 {
 public:
 	_MAPFSAT_SMT(int, int, int, int, int, int solver = 2, std::string name = "SMT_encoding");
 	~_MAPFSAT_SMT() {};
 private:
-	int CreateFormula(int);
+	int CreateFormula();
+	_MAPFSAT_ISolver* NewSolver();
 
-	void AddClause(std::vector<int>);
+	void AddLiteral(int);
 	void CreateSolver();
 	void ReleaseSolver();
-	int InvokeSolverImplementation(int);
+	int InvokeSolverImplementation();
 
 	// specialized functions
 	int CreateMove_Graph_MonosatPass(int);
@@ -1,16 +1,84 @@
 #include "instance.hpp"
 
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
 using namespace std;
 
+static const uint16_t unreachable = 0xFFFF; // distance of vertices not reachable by an agent
+
+// read only memory mapped file, data is NULL if the file could not be read
+struct _MAPFSAT_MappedFile
+{
+	const char* data = NULL;
+	size_t size = 0;
+
+	_MAPFSAT_MappedFile(const string& path)
+	{
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
+		struct stat file_stat;
+		if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+		{
+			void* mapped = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapped != MAP_FAILED)
+			{
+				data = (const char*)mapped;
+				size = file_stat.st_size;
+			}
+		}
+		close(fd);
+	}
+
+	~_MAPFSAT_MappedFile()
+	{
+		if (data != NULL)
+			munmap((void*)data, size);
+	}
+};
+
+// tokenizing of the mapped files
+static void SkipSpace(const char*& pos, const char* end)
+{
+	while (pos < end && isspace((unsigned char)*pos))
+		pos++;
+}
+
+static void SkipWord(const char*& pos, const char* end)
+{
+	SkipSpace(pos, end);
+	while (pos < end && !isspace((unsigned char)*pos))
+		pos++;
+}
+
+static size_t ReadNumber(const char*& pos, const char* end)
+{
+	SkipSpace(pos, end);
+	size_t number = 0;
+	while (pos < end && *pos >= '0' && *pos <= '9')
+		number = number * 10 + (*pos++ - '0');
+	return number;
+}
+
 /****************************/
 // MARK: constructor
 /****************************/
 
 // instance from file
-_MAPFSAT_Instance::_MAPFSAT_Instance(string map_dir, string agents_file)
+_MAPFSAT_Instance::_MAPFSAT_Instance(string map_dir, string agents_file, _MAPFSAT_MapCache* map_cache)
 {
-	LoadAgents(agents_file, map_dir);
+	LoadAgents(agents_file, map_dir, map_cache);
 	last_number_of_agents = 0;
+	threads = 1;
+	lazy_distances = false;
 	scen_name = agents_file;
 }
 
@@ -21,10 +89,52 @@ _MAPFSAT_Instance::_MAPFSAT_Instance(vector<vector<int> >& map_vector, vector<pa
 	LoadAgentsData(starts, goals);
 	LoadMapData(map_vector);
 	last_number_of_agents = 0;
+	threads = 1;
+	lazy_distances = false;
 	scen_name = scenstr;
 	map_name = mapstr;
 }
 
+// map only, stored in _MAPFSAT_MapCache
+_MAPFSAT_Instance::_MAPFSAT_Instance(string map_path)
+{
+	LoadMap(map_path);
+	last_number_of_agents = 0;
+	threads = 1;
+	lazy_distances = false;
+}
+
+// instance of a group of agents
+_MAPFSAT_Instance::_MAPFSAT_Instance(_MAPFSAT_Instance& parent, const vector<int>& group)
+{
+	CopyMap(parent);
+	avoid_locations = parent.avoid_locations;
+	threads = 1;
+	lazy_distances = false;
+	scen_name = parent.scen_name;
+	map_name = parent.map_name;
+
+	mks_LBs = vector<int>(group.size() + 1, -1);
+	soc_LBs = vector<int>(group.size() + 1, -1);
+	mks_LBs[0] = 0;
+	soc_LBs[0] = 0;
+	SP_lengths = vector<int>(group.size(), 0);
+	distances_computed.reset(new once_flag[group.size()]);
+
+	for (size_t i = 0; i < group.size(); i++)
+	{
+		parent.Distance(group[i], 0);	// lazy distances are computed now
+		agents.push_back(parent.agents[group[i]]);
+		distances.push_back(parent.distances[group[i]]);
+		call_once(distances_computed[i], [](){});
+
+		SP_lengths[i] = parent.SP_lengths[group[i]];
+		mks_LBs[i+1] = max(mks_LBs[i], SP_lengths[i] + 1);
+		soc_LBs[i+1] = soc_LBs[i] + SP_lengths[i] + 1;
+	}
+	last_number_of_agents = group.size();
+}
+
 /****************************/
 // MARK: public functions
 /****************************/
@@ -47,22 +157,52 @@ int _MAPFSAT_Instance::GetSocLB(size_t ags)
 
 void _MAPFSAT_Instance::SetAgents(int ags)
 {
-	for (int i = last_number_of_agents; i < ags; i++)
-	{
-		length_from_start[i] = vector<int>(number_of_vertices, -1);
-		length_from_goal[i] = vector<int>(number_of_vertices, -1);
+	size_t cached = last_number_of_agents;
+	if (!distance_cache_dir.empty())
+		cached = LoadDistanceCache(last_number_of_agents, ags);
+
+	for (size_t i = last_number_of_agents; i < cached; i++)
+		call_once(distances_computed[i], [](){});
 
-		BFS(length_from_start[i], agents[i].start);
-		BFS(length_from_goal[i], agents[i].goal);
+	if (cached < size_t(ags) && !lazy_distances)
+		ComputeDistances(cached, ags);
 
-		SP_lengths[i] = length_from_start[i][map[agents[i].goal.x][agents[i].goal.y]];
+	for (int i = last_number_of_agents; i < ags; i++)
+	{
+		if (lazy_distances && size_t(i) >= cached)
+		{
+			SP_lengths[i] = ShortestPathLength(i);
+			if (SP_lengths[i] >= unreachable)
+				throw runtime_error("Distances on the map do not fit into 16 bits");
+		}
+		else
+			SP_lengths[i] = FirstTimestep(i, map[agents[i].goal.x][agents[i].goal.y]);
 
 		mks_LBs[i+1] = max(mks_LBs[i], SP_lengths[i] + 1);
 		soc_LBs[i+1] = soc_LBs[i] + SP_lengths[i] + 1;
 	}
+
+	if (!distance_cache_dir.empty() && cached < size_t(ags) && !lazy_distances)
+		StoreDistanceCache(ags);
 	last_number_of_agents = ags;
 }
 
+void _MAPFSAT_Instance::SetDistanceCache(string cache_dir)
+{
+	distance_cache_dir = cache_dir;
+}
+
+void _MAPFSAT_Instance::SetThreads(int nr_threads)
+{
+	threads = max(1, nr_threads);
+}
+
+void _MAPFSAT_Instance::SetLazyDistances(bool lazy)
+{
+	// a search on a smaller map ends before the length 0xFFFF, larger maps are checked by SetAgents
+	lazy_distances = lazy && number_of_vertices < unreachable;
+}
+
 void _MAPFSAT_Instance::LoadAvoidData(vector<pair<pair<int,int> ,int> >& avoid)
 {
 	if (avoid.empty())
@@ -93,43 +233,18 @@ bool _MAPFSAT_Instance::HasNeighbor(_MAPFSAT_Vertex v, int dir)
 	return false;
 }
 
-bool _MAPFSAT_Instance::HasNeighbor(int v, int dir)
-{
-	if (dir == 0) // self loop
-		return true;
-	return HasNeighbor(IDtoCoords(v), dir);
-}
-
-int _MAPFSAT_Instance::GetNeighbor(int ver, int dir) // assumes the neighbor exists
-{
-	if (dir == 0) // self loop
-		return ver;
-
-	_MAPFSAT_Vertex v = IDtoCoords(ver);
-
-	if (dir == 1 && v.x > 0)
-		return map[v.x - 1][v.y];
-	if (dir == 2 && v.x < height - 1)
-		return map[v.x + 1][v.y];
-	if (dir == 3 && v.y > 0)
-		return map[v.x][v.y - 1];
-	if (dir == 4 && v.y < width - 1)
-		return map[v.x][v.y + 1];
-	return -1;
-}
-
 int _MAPFSAT_Instance::FirstTimestep(int agent, int vertex)
 {
-	return length_from_start[agent][vertex];
+	return Distance(agent, vertex);
 }
 
 int _MAPFSAT_Instance::LastTimestep(int agent, int vertex, int timelimit, int delta, int cost_function)
 {
 	if (cost_function == 1) // makespan
-		return timelimit - length_from_goal[agent][vertex] - 1;
+		return timelimit - Distance(agent, number_of_vertices + vertex) - 1;
 
 	if (cost_function == 2) // sum of costs
-		return SP_lengths[agent] + delta - length_from_goal[agent][vertex];
+		return SP_lengths[agent] + delta - Distance(agent, number_of_vertices + vertex);
 
 	return -1; // should not get here
 }
@@ -149,45 +264,155 @@ int _MAPFSAT_Instance::OppositeDir(int dir)
 	return -1; // should not get here
 }
 
+vector<int> _MAPFSAT_Instance::ShortestPath(int agent)
+{
+	// walk back from the goal over vertices closer to the start
+	int v = map[agents[agent].goal.x][agents[agent].goal.y];
+	int length = FirstTimestep(agent, v);
+	if (length < 0)
+		return vector<int>();
+
+	vector<int> path(length + 1);
+	path[length] = v;
+	for (int t = length; t > 0; t--)
+	{
+		for (int dir = 1; dir < 5; dir++)
+		{
+			int u = neighbors[5 * v + dir];
+			if (u != -1 && FirstTimestep(agent, u) == t - 1)
+			{
+				v = u;
+				break;
+			}
+		}
+		path[t - 1] = v;
+	}
+	return path;
+}
+
+int _MAPFSAT_Instance::GetConflictMksLB(size_t ags, int movement)
+{
+	for (size_t a = 0; a < ags; a++)
+		if (SP_lengths[a] < 0)
+			return GetMksLB(ags);
+
+	// every cardinal conflict proves that the makespan does not suffice, stop at the number of vertices in case the instance is unsolvable
+	int mks = GetMksLB(ags);
+	vector<pair<int,int> > conflicts;
+	while (mks < GetMksLB(ags) + (int)number_of_vertices)
+	{
+		conflicts.clear();
+		CardinalConflicts(ags, movement, mks, conflicts);
+		if (conflicts.empty())
+			break;
+		mks++;
+	}
+	return mks;
+}
+
+int _MAPFSAT_Instance::GetConflictSocLB(size_t ags, int movement)
+{
+	for (size_t a = 0; a < ags; a++)
+		if (SP_lengths[a] < 0)
+			return GetSocLB(ags);
+
+	vector<pair<int,int> > conflicts;
+	CardinalConflicts(ags, movement, 0, conflicts);
+
+	// greedy matching of the conflict graph, agents with fewer conflicts first
+	vector<int> degree(ags, 0);
+	for (size_t i = 0; i < conflicts.size(); i++)
+	{
+		degree[conflicts[i].first]++;
+		degree[conflicts[i].second]++;
+	}
+	stable_sort(conflicts.begin(), conflicts.end(), [&degree](const pair<int,int>& c1, const pair<int,int>& c2)
+		{ return degree[c1.first] + degree[c1.second] < degree[c2.first] + degree[c2.second]; });
+
+	vector<bool> matched(ags, false);
+	int increase = 0;
+	for (size_t i = 0; i < conflicts.size(); i++)
+	{
+		if (matched[conflicts[i].first] || matched[conflicts[i].second])
+			continue;
+		matched[conflicts[i].first] = true;
+		matched[conflicts[i].second] = true;
+		increase++;
+	}
+	return GetSocLB(ags) + increase;
+}
+
 /****************************/
 // MARK: private functions
 /****************************/
 
-void _MAPFSAT_Instance::LoadAgents(string agents_path, string map_dir)
+void _MAPFSAT_Instance::CopyMap(const _MAPFSAT_Instance& source)
+{
+	map = source.map;
+	neighbors = source.neighbors;
+	neighbor_mask = source.neighbor_mask;
+	corridors = source.corridors;
+	corridor_of = source.corridor_of;
+	coord_list = source.coord_list;
+	height = source.height;
+	width = source.width;
+	number_of_vertices = source.number_of_vertices;
+}
+
+void _MAPFSAT_Instance::LoadAgents(string agents_path, string map_dir, _MAPFSAT_MapCache* map_cache)
 {
 	// Read input
 	bool map_loaded = false;
-	ifstream in;
-	in.open(agents_path);
-	if (!in.is_open())
+	_MAPFSAT_MappedFile in(agents_path);
+	if (in.data == NULL)
 	{
 		cerr << "Could not open scenario file " << agents_path << endl;
 		return;
 	}
 
-	string line;
-	getline(in, line); // first line - version
+	const char* end = in.data + in.size;
+	const char* line = find(in.data, end, '\n'); // first line - version
 
-	while (getline(in, line))
+	while (line < end)
 	{
-		stringstream ssline(line);
-		string part;
-		vector<string> parsed_line;
-		while (getline(ssline, part, '\t'))
-			parsed_line.push_back(part);
+		line++;
+		const char* line_end = find(line, end, '\n');
+
+		// bucket, map, width, height, start x, start y, goal x, goal y, optimal length - separated by tabs
+		const char* field[8];
+		int nr_fields = 0;
+		field[nr_fields++] = line;
+		for (const char* pos = line; pos < line_end && nr_fields < 8; pos++)
+			if (*pos == '\t')
+				field[nr_fields++] = pos + 1;
 
-		if (!map_loaded)
+		if (nr_fields == 8)
 		{
-			map_name = parsed_line[1];
-			LoadMap(map_dir.append("/").append(map_name));
-			map_loaded = true;
-		}
+			if (!map_loaded)
+			{
+				map_name = string(field[1], field[2] - 1);
+				string map_path = map_dir.append("/").append(map_name);
+				if (map_cache == NULL)
+					LoadMap(map_path);
+				else
+				{
+					lock_guard<mutex> guard(map_cache->lock);
+					unique_ptr<_MAPFSAT_Instance>& cached = map_cache->maps[map_path];
+					if (!cached)
+						cached.reset(new _MAPFSAT_Instance(map_path));
+					CopyMap(*cached);
+				}
+				map_loaded = true;
+			}
 
-		_MAPFSAT_Agent new_agent;
-		new_agent.start = {size_t(stoi(parsed_line[5])), size_t(stoi(parsed_line[4]))};
-		new_agent.goal = {size_t(stoi(parsed_line[7])), size_t(stoi(parsed_line[6]))};
+			_MAPFSAT_Agent new_agent;
+			new_agent.start = {ReadNumber(field[5], line_end), ReadNumber(field[4], line_end)};
+			new_agent.goal = {ReadNumber(field[7], line_end), ReadNumber(field[6], line_end)};
 
-		agents.push_back(new_agent);
+			agents.push_back(new_agent);
+		}
+
+		line = line_end;
 	}
 
 	mks_LBs = vector<int>(agents.size() + 1, -1);
@@ -195,10 +420,8 @@ void _MAPFSAT_Instance::LoadAgents(string agents_path, string map_dir)
 	mks_LBs[0] = 0;
 	soc_LBs[0] = 0;
 	SP_lengths = vector<int>(agents.size(), 0);
-	length_from_start = vector<vector<int> >(agents.size());
-	length_from_goal = vector<vector<int> >(agents.size());
-
-	in.close();
+	distances = vector<vector<uint16_t> >(agents.size());
+	distances_computed.reset(new once_flag[agents.size()]);
 }
 
 void _MAPFSAT_Instance::LoadAgentsData(vector<pair<int,int> >& start, vector<pair<int,int> >& goal)
@@ -217,38 +440,42 @@ void _MAPFSAT_Instance::LoadAgentsData(vector<pair<int,int> >& start, vector<pai
 	mks_LBs[0] = 0;
 	soc_LBs[0] = 0;
 	SP_lengths = vector<int>(agents.size(), 0);
-	length_from_start = vector<vector<int> >(agents.size());
-	length_from_goal = vector<vector<int> >(agents.size());
+	distances = vector<vector<uint16_t> >(agents.size());
+	distances_computed.reset(new once_flag[agents.size()]);
 }
 
 void _MAPFSAT_Instance::LoadMap(string map_path)
 {
-	ifstream in;
-	in.open(map_path);
-	if (!in.is_open())
+	_MAPFSAT_MappedFile in(map_path);
+	if (in.data == NULL)
 	{
 		cerr << "Could not open map file " << map_path << endl;
 		return;
 	}
 
-	char c_dump;
-	string s_dump;
-	getline(in, s_dump); // first line - type
+	const char* pos = in.data;
+	const char* end = in.data + in.size;
+	pos = find(pos, end, '\n'); // first line - type
 
-	in >> s_dump >> height;
-	in >> s_dump >> width;
-	in >> s_dump; // map
+	SkipWord(pos, end); // height
+	height = ReadNumber(pos, end);
+	SkipWord(pos, end); // width
+	width = ReadNumber(pos, end);
+	SkipWord(pos, end); // map
 	
 	// graph
-	map = vector<vector<int> >(height, vector<int>(width, -1));
+	map.width = width;
+	map.cells.assign(height * width, -1);
 	number_of_vertices = 0;
 
 	for (size_t i = 0; i < height; i++)
 	{
 		for (size_t j = 0; j < width; j++)
 		{
-			in >> c_dump;
-			if (c_dump == '.')
+			SkipSpace(pos, end);
+			if (pos == end)
+				break;
+			if (*pos++ == '.')
 			{
 				map[i][j] = number_of_vertices;
 				number_of_vertices++;
@@ -257,14 +484,18 @@ void _MAPFSAT_Instance::LoadMap(string map_path)
 		}
 	}
 
-	in.close();
+	CreateNeighbors();
+	CreateCorridors();
 }
 
 void _MAPFSAT_Instance::LoadMapData(std::vector<std::vector<int> >& map_vector)
 {
-	map = map_vector;
-	height = map.size();
-	width = map[0].size();
+	height = map_vector.size();
+	width = map_vector[0].size();
+	map.width = width;
+	map.cells.resize(height * width);
+	for (size_t i = 0; i < height; i++)
+		copy(map_vector[i].begin(), map_vector[i].end(), map[i]);
 
 	number_of_vertices = 0;
 
@@ -280,41 +511,486 @@ void _MAPFSAT_Instance::LoadMapData(std::vector<std::vector<int> >& map_vector)
 			}
 		}
 	}
+
+	CreateNeighbors();
+	CreateCorridors();
 }
 
-void _MAPFSAT_Instance::BFS(vector<int>& length_from, _MAPFSAT_Vertex start)
+void _MAPFSAT_Instance::CreateNeighbors()
 {
-	queue<_MAPFSAT_Vertex> que;
+	neighbors.assign(5 * number_of_vertices, -1);
+	neighbor_mask.assign(number_of_vertices, 0);
 
-	length_from[map[start.x][start.y]] = 0;
-	que.push(start);
+	for (size_t v = 0; v < number_of_vertices; v++)
+	{
+		_MAPFSAT_Vertex coords = coord_list[v];
+		for (int dir = 0; dir < 5; dir++)
+		{
+			if (!HasNeighbor(coords, dir))
+				continue;
+
+			int u = v;
+			if (dir == 1)
+				u = map[coords.x - 1][coords.y];
+			if (dir == 2)
+				u = map[coords.x + 1][coords.y];
+			if (dir == 3)
+				u = map[coords.x][coords.y - 1];
+			if (dir == 4)
+				u = map[coords.x][coords.y + 1];
 
-	while(!que.empty())
+			neighbors[5 * v + dir] = u;
+			neighbor_mask[v] |= 1 << dir;
+		}
+	}
+}
+
+void _MAPFSAT_Instance::CreateCorridors()
+{
+	corridors.clear();
+	corridor_of.assign(number_of_vertices, -1);
+
+	auto in_corridor = [&](int v)
 	{
-		_MAPFSAT_Vertex v = que.front();
-		que.pop();
+		return __builtin_popcount(neighbor_mask[v] & 0x1E) == 2;	// ignore waiting, ie. selfloops
+	};
+	auto other_side = [&](int v, int from)	// the neighbor of a corridor cell that is not from
+	{
+		for (int dir = 1; dir < 5; dir++)
+		{
+			if (HasNeighbor(v, dir) && GetNeighbor(v, dir) != from)
+				return GetNeighbor(v, dir);
+		}
+		return -1;
+	};
+
+	for (size_t v = 0; v < number_of_vertices; v++)
+	{
+		if (corridor_of[v] != -1 || !in_corridor(v))
+			continue;
 
-		if (HasNeighbor(v,1) && length_from[map[v.x - 1][v.y]] == -1)
+		// walk to one end of the chain, a chain closed into a cycle starts at v
+		int prev = v;
+		int cur = other_side(v, -1);
+		while (cur != (int)v && in_corridor(cur))
 		{
-			length_from[map[v.x - 1][v.y]] = length_from[map[v.x][v.y]] + 1;
-			que.push({v.x - 1, v.y});
+			int next = other_side(cur, prev);
+			prev = cur;
+			cur = next;
 		}
-		if (HasNeighbor(v,2) && length_from[map[v.x + 1][v.y]] == -1)
+
+		// collect the cells from the end towards the other end
+		int cell = (cur == (int)v) ? v : prev;
+		int from = (cur == (int)v) ? other_side(v, -1) : cur;
+		corridors.push_back(std::vector<int>());
+		while (corridor_of[cell] == -1 && in_corridor(cell))
 		{
-			length_from[map[v.x + 1][v.y]] = length_from[map[v.x][v.y]] + 1;
-			que.push({v.x + 1, v.y});
+			corridor_of[cell] = corridors.size() - 1;
+			corridors.back().push_back(cell);
+			int next = other_side(cell, from);
+			from = cell;
+			cell = next;
 		}
-		if (HasNeighbor(v,3) && length_from[map[v.x][v.y - 1]] == -1)
+	}
+}
+
+void _MAPFSAT_Instance::ComputeDistances(size_t from, size_t to)
+{
+	// agents sharing a start or a goal share one search, distances from a vertex are computed once
+	vector<int> sources;
+	vector<uint16_t*> targets;
+	vector<int> source_of_vertex(number_of_vertices, -1);
+	vector<pair<uint16_t*, int> > copies;
+
+	auto add_source = [&](_MAPFSAT_Vertex v, uint16_t* length_from)
+	{
+		int vertex = map[v.x][v.y];
+		if (source_of_vertex[vertex] == -1)
+		{
+			source_of_vertex[vertex] = sources.size();
+			sources.push_back(vertex);
+			targets.push_back(length_from);
+		}
+		else
+			copies.push_back({length_from, source_of_vertex[vertex]});
+	};
+
+	for (size_t i = from; i < to; i++)
+	{
+		distances[i].assign(2 * number_of_vertices, unreachable);
+		add_source(agents[i].start, distances[i].data());
+		add_source(agents[i].goal, distances[i].data() + number_of_vertices);
+	}
+
+	// nearby sources reach most vertices in the same levels, so they are batched together
+	vector<size_t> order(sources.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	auto morton = [&](int vertex)
+	{
+		uint64_t code = 0;
+		for (int bit = 0; bit < 32; bit++)
+			code |= (uint64_t((coord_list[vertex].x >> bit) & 1) << (2 * bit)) | (uint64_t((coord_list[vertex].y >> bit) & 1) << (2 * bit + 1));
+		return code;
+	};
+	sort(order.begin(), order.end(), [&](size_t a, size_t b) { return morton(sources[a]) < morton(sources[b]); });
+	vector<int> sorted_sources(sources.size());
+	vector<uint16_t*> sorted_targets(sources.size());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		sorted_sources[i] = sources[order[i]];
+		sorted_targets[i] = targets[order[i]];
+	}
+
+	// batches of 64 sources are independent, they are shared among threads
+	size_t batches = (sources.size() + 63) / 64;
+	atomic<size_t> next_batch(0);
+	atomic<bool> overflow(false);
+	auto worker = [&]()
+	{
+		size_t b;
+		while ((b = next_batch++) < batches)
+		{
+			size_t first = b * 64;
+			size_t count = min(sources.size() - first, size_t(64));
+			if (!BFS(&sorted_sources[first], &sorted_targets[first], count))
+				overflow = true;
+		}
+	};
+
+	int nr_threads = min(size_t(threads), batches);
+	if (nr_threads <= 1)
+		worker();
+	else
+	{
+		vector<thread> workers;
+		for (int i = 0; i < nr_threads; i++)
+			workers.push_back(thread(worker));
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	if (overflow)	// do not keep incomplete distances
+	{
+		for (size_t i = from; i < to; i++)
+			vector<uint16_t>().swap(distances[i]);
+		throw runtime_error("Distances on the map do not fit into 16 bits");
+	}
+
+	for (size_t i = 0; i < copies.size(); i++)
+		copy(targets[copies[i].second], targets[copies[i].second] + number_of_vertices, copies[i].first);
+
+	for (size_t i = from; i < to; i++)
+		call_once(distances_computed[i], [](){});
+}
+
+void _MAPFSAT_Instance::ComputeAgentDistances(int agent)
+{
+	distances[agent].assign(2 * number_of_vertices, unreachable);
+	int sources[2] = {map[agents[agent].start.x][agents[agent].start.y], map[agents[agent].goal.x][agents[agent].goal.y]};
+	uint16_t* targets[2] = {distances[agent].data(), distances[agent].data() + number_of_vertices};
+	BFS(sources, targets, 2);	// can not overflow, lazy distances are used only on smaller maps
+}
+
+bool _MAPFSAT_Instance::BFS(const int* sources, uint16_t** length_from, size_t count)
+{
+	// bit i of a mask belongs to sources[i], all sources are expanded one level at a time
+	struct Masks
+	{
+		uint64_t visited;
+		uint64_t frontier;
+		uint64_t next;
+	};
+	vector<Masks> masks(number_of_vertices, {0, 0, 0});
+	vector<int> current_vertices;
+	vector<int> next_vertices;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		length_from[i][sources[i]] = 0;
+
+		if (masks[sources[i]].frontier == 0)
+			current_vertices.push_back(sources[i]);
+		masks[sources[i]].frontier |= uint64_t(1) << i;
+		masks[sources[i]].visited |= uint64_t(1) << i;
+	}
+
+	for (int length = 1; !current_vertices.empty(); length++)
+	{
+		if (length == unreachable)	// the distance does not fit, the caller drops the distances
+			return false;
+
+		for (size_t i = 0; i < current_vertices.size(); i++)
+		{
+			int v = current_vertices[i];
+			uint64_t frontier = masks[v].frontier;
+			masks[v].frontier = 0;
+
+			for (int dir = 1; dir < 5; dir++)
+			{
+				int u = neighbors[5 * v + dir];
+				if (u == -1)
+					continue;
+
+				uint64_t reached = frontier & ~masks[u].visited;
+				if (reached == 0)
+					continue;
+				if (masks[u].next == 0)
+					next_vertices.push_back(u);
+				masks[u].visited |= reached;
+				masks[u].next |= reached;
+			}
+		}
+
+		for (size_t i = 0; i < next_vertices.size(); i++)
+		{
+			int u = next_vertices[i];
+			masks[u].frontier = masks[u].next;
+			masks[u].next = 0;
+
+			for (uint64_t bits = masks[u].frontier; bits != 0; bits &= bits - 1)
+				length_from[__builtin_ctzll(bits)][u] = length;
+		}
+
+		current_vertices.swap(next_vertices);
+		next_vertices.clear();
+	}
+
+	return true;
+}
+
+int _MAPFSAT_Instance::ShortestPathLength(int agent)
+{
+	int start = map[agents[agent].start.x][agents[agent].start.y];
+	int goal = map[agents[agent].goal.x][agents[agent].goal.y];
+	vector<int> length_from(number_of_vertices, -1);
+	queue<int> que;
+
+	length_from[start] = 0;
+	que.push(start);
+
+	while (!que.empty() && length_from[goal] == -1)
+	{
+		int v = que.front();
+		que.pop();
+
+		for (int dir = 1; dir < 5; dir++)
+		{
+			int u = neighbors[5 * v + dir];
+			if (u != -1 && length_from[u] == -1)
+			{
+				length_from[u] = length_from[v] + 1;
+				que.push(u);
+			}
+		}
+	}
+
+	return length_from[goal];
+}
+
+int _MAPFSAT_Instance::Distance(int agent, size_t index)
+{
+	if (lazy_distances)
+		call_once(distances_computed[agent], &_MAPFSAT_Instance::ComputeAgentDistances, this, agent);
+
+	uint16_t length = distances[agent][index];
+	return (length == unreachable) ? -1 : length;
+}
+
+void _MAPFSAT_Instance::SingleLayers(int agent, int limit, int horizon, vector<int>& layer)
+{
+	// vertex v is in layer t if FirstTimestep <= t <= limit - distance to the goal, the agent stays at its goal after limit
+	// widths of the layers and xor of their vertices by difference arrays, the xor of a layer of width one is its vertex
+	vector<int> width(horizon + 1, 0);
+	vector<int> xored(horizon + 1, 0);
+	for (size_t v = 0; v < number_of_vertices; v++)
+	{
+		int first = Distance(agent, v);
+		if (first < 0)
+			continue;
+		int last = limit - Distance(agent, number_of_vertices + v);
+		if (v == (size_t)map[agents[agent].goal.x][agents[agent].goal.y])
+			last = horizon - 1;
+		if (last < first)
+			continue;
+		width[first]++;
+		width[last + 1]--;
+		xored[first] ^= v;
+		xored[last + 1] ^= v;
+	}
+
+	layer.assign(horizon, -1);
+	int current_width = 0;
+	int current_xor = 0;
+	for (int t = 0; t < horizon; t++)
+	{
+		current_width += width[t];
+		current_xor ^= xored[t];
+		if (current_width == 1)
+			layer[t] = current_xor;
+	}
+}
+
+void _MAPFSAT_Instance::CardinalConflicts(size_t ags, int movement, int timelimit, vector<pair<int,int> >& conflicts)
+{
+	// timelimit 0 = each agent arrives at its shortest path length, otherwise all agents arrive by timelimit
+	int horizon = timelimit;
+	if (timelimit == 0)
+		for (size_t a = 0; a < ags; a++)
+			horizon = max(horizon, SP_lengths[a] + 1);
+
+	vector<tuple<int,int,int> > occupied;		// t, v, agent for layers with a single vertex
+	vector<tuple<int,int,int,int> > moves;		// t, v, u, agent for moves between two such layers
+	vector<int> layer;
+	for (size_t a = 0; a < ags; a++)
+	{
+		int limit = (timelimit == 0) ? SP_lengths[a] : timelimit - 1;
+		SingleLayers(a, limit, horizon, layer);
+		for (int t = 0; t < horizon; t++)
 		{
-			length_from[map[v.x][v.y - 1]] = length_from[map[v.x][v.y]] + 1;
-			que.push({v.x, v.y - 1});
+			if (layer[t] == -1)
+				continue;
+			occupied.push_back(make_tuple(t, layer[t], a));
+			if (t + 1 < horizon && layer[t + 1] != -1 && layer[t + 1] != layer[t])
+				moves.push_back(make_tuple(t, layer[t], layer[t + 1], a));
 		}
-		if (HasNeighbor(v,4) && length_from[map[v.x][v.y + 1]] == -1)
+	}
+	sort(occupied.begin(), occupied.end());
+	sort(moves.begin(), moves.end());
+
+	// vertex conflicts
+	for (size_t i = 1; i < occupied.size(); i++)
+		if (get<0>(occupied[i - 1]) == get<0>(occupied[i]) && get<1>(occupied[i - 1]) == get<1>(occupied[i]))
+			conflicts.push_back(make_pair(get<2>(occupied[i - 1]), get<2>(occupied[i])));
+
+	for (size_t i = 0; i < moves.size(); i++)
+	{
+		int t = get<0>(moves[i]);
+		int v = get<1>(moves[i]);
+		int u = get<2>(moves[i]);
+		int a = get<3>(moves[i]);
+
+		// swapping conflicts
+		if (v < u)
+			for (auto it = lower_bound(moves.begin(), moves.end(), make_tuple(t, u, v, 0)); it != moves.end() && get<0>(*it) == t && get<1>(*it) == u && get<2>(*it) == v; it++)
+				conflicts.push_back(make_pair(a, get<3>(*it)));
+
+		// pebble motion, moving into a vertex occupied in the previous timestep
+		if (movement == 2)
+			for (auto it = lower_bound(occupied.begin(), occupied.end(), make_tuple(t, u, 0)); it != occupied.end() && get<0>(*it) == t && get<1>(*it) == u; it++)
+				if (get<2>(*it) != a)
+					conflicts.push_back(make_pair(a, get<2>(*it)));
+	}
+
+	for (size_t i = 0; i < conflicts.size(); i++)
+		if (conflicts[i].first > conflicts[i].second)
+			swap(conflicts[i].first, conflicts[i].second);
+	sort(conflicts.begin(), conflicts.end());
+	conflicts.erase(unique(conflicts.begin(), conflicts.end()), conflicts.end());
+}
+
+/****************************/
+// MARK: distance cache
+/****************************/
+
+// cache file: "MAPFDIST", version, number of vertices, number of stored agents, 0 (uint32 each, native byte order)
+// followed by the distances from start and from goal of each stored agent (uint16 per vertex, 0xFFFF unreachable)
+// the name is a hash of the map and the endpoints of all agents, a changed instance uses a new file
+// a file of another version or number of vertices is not loaded and is overwritten by the next store
+// writers hold flock and write the header after the distances, so readers without the lock see only complete agents
+static const size_t distance_cache_header = 24;
+static const uint32_t distance_cache_version = 2;	// 1 stored int32 distances
+
+string _MAPFSAT_Instance::DistanceCacheFile()
+{
+	// FNV-1a hash of the map and the endpoints of all agents
+	unsigned long long hash = 14695981039346656037ULL;
+	auto add = [&hash](unsigned long long value)
+	{
+		for (int i = 0; i < 8; i++)
 		{
-			length_from[map[v.x][v.y + 1]] = length_from[map[v.x][v.y]] + 1;
-			que.push({v.x, v.y + 1});
+			hash ^= (value >> (8 * i)) & 0xff;
+			hash *= 1099511628211ULL;
 		}
+	};
+
+	add(height);
+	add(width);
+	for (size_t i = 0; i < map.cells.size(); i++)
+		add(map.cells[i] == -1);
+	add(agents.size());
+	for (size_t i = 0; i < agents.size(); i++)
+	{
+		add(agents[i].start.x);
+		add(agents[i].start.y);
+		add(agents[i].goal.x);
+		add(agents[i].goal.y);
 	}
+
+	stringstream file;
+	file << distance_cache_dir << "/" << hex << hash << ".dist";
+	return file.str();
+}
+
+size_t _MAPFSAT_Instance::LoadDistanceCache(size_t from, size_t to)
+{
+	_MAPFSAT_MappedFile in(DistanceCacheFile());
+	if (in.data == NULL || in.size < distance_cache_header || string(in.data, 8) != "MAPFDIST")
+		return from;
+
+	uint32_t header[4];
+	memcpy(header, in.data + 8, sizeof(header));
+	if (header[0] != distance_cache_version || header[1] != number_of_vertices)
+		return from;
+
+	size_t agent_size = 2 * number_of_vertices * sizeof(uint16_t);
+	size_t stored = min(size_t(header[2]), (in.size - distance_cache_header) / agent_size);
+	size_t loaded = max(from, min(stored, to));
+
+	for (size_t i = from; i < loaded; i++)
+	{
+		distances[i].resize(2 * number_of_vertices);
+		memcpy(distances[i].data(), in.data + distance_cache_header + i * agent_size, agent_size);
+	}
+
+	return loaded;
+}
+
+void _MAPFSAT_Instance::StoreDistanceCache(size_t ags)
+{
+	int fd = open(DistanceCacheFile().c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return;
+	flock(fd, LOCK_EX);	// other runs may store the same instance
+
+	// distances are the same in every run, so only agents missing in the file are appended
+	char header[distance_cache_header] = "MAPFDIST";
+	uint32_t stored = 0;
+	size_t agent_size = 2 * number_of_vertices * sizeof(uint16_t);
+	struct stat st;
+	if (pread(fd, header, distance_cache_header, 0) == (ssize_t)distance_cache_header && string(header, 8) == "MAPFDIST" && fstat(fd, &st) == 0)
+	{
+		uint32_t values[4];
+		memcpy(values, header + 8, sizeof(values));
+		if (values[0] == distance_cache_version && values[1] == number_of_vertices)	// otherwise the file is overwritten
+			stored = min(size_t(values[2]), (st.st_size - distance_cache_header) / agent_size);	// a partially written file
+	}
+
+	if (stored < ags)
+	{
+		bool written = true;
+		for (size_t i = stored; i < ags && written; i++)
+			written = pwrite(fd, distances[i].data(), agent_size, distance_cache_header + i * agent_size) == (ssize_t)agent_size;
+
+		uint32_t values[4] = {distance_cache_version, uint32_t(number_of_vertices), uint32_t(ags), 0};
+		memcpy(header, "MAPFDIST", 8);
+		memcpy(header + 8, values, sizeof(values));
+		if (written && pwrite(fd, header, distance_cache_header, 0) != (ssize_t)distance_cache_header)
+			cerr << "Could not store distances into the cache" << endl;
+	}
+
+	flock(fd, LOCK_UN);
+	close(fd);
 }
 
 /****************************/
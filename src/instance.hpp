@@ -9,6 +9,11 @@
 #include <tuple>
 #include <queue>
 #include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <stdexcept>
 
 struct _MAPFSAT_Vertex
 {
@@ -35,6 +40,18 @@ struct _MAPFSAT_Avoid
 	int t;
 };
 
+// row-major grid, map[x][y] is the id of the vertex or -1 for an obstacle
+struct _MAPFSAT_Grid
+{
+	std::vector<int> cells;
+	size_t width = 0;
+
+	int* operator[](size_t x) { return &cells[x * width]; }
+	const int* operator[](size_t x) const { return &cells[x * width]; }
+};
+
+struct _MAPFSAT_MapCache;
+
 class _MAPFSAT_Instance
 {
 public:
@@ -44,8 +61,9 @@ public:
     *
     * @param map_dir directory including the map.
     * @param agents_file file containing the solved scenario.
+    * @param map_cache maps loaded by other instances, the map is copied from it or loaded and stored into it. Default is NULL, ie. the map is always loaded.
     */
-    _MAPFSAT_Instance(std::string, std::string);
+    _MAPFSAT_Instance(std::string, std::string, _MAPFSAT_MapCache* = NULL);
 
     /** Constructor of _MAPFSAT_Instance using data.
     *
@@ -59,14 +77,50 @@ public:
     */
     _MAPFSAT_Instance(std::vector<std::vector<int> >&, std::vector<std::pair<int,int> >&, std::vector<std::pair<int,int> >&, std::string = "scen", std::string = "map");
 
+    /** Constructor of _MAPFSAT_Instance for a group of agents of another instance.
+    *
+    * Copies the map, the avoided locations and the distances of the agents in the group, the agents are numbered by their order in the group. All agents of the group are already set.
+    *
+    * @param instance the instance the agents are taken from, agents of the group have to be set in it.
+    * @param group indices of the agents in the instance.
+    */
+    _MAPFSAT_Instance(_MAPFSAT_Instance&, const std::vector<int>&);
+
     /** Set the number of agents to be computed.
     *
     * Computes reachability and lower bounds for agents that were not used before. Does not check if ags is out of bounds.
+    * Distances are stored in 16 bits, std::runtime_error is thrown if a distance of a new agent does not fit. The distances of the new agents are not kept then.
     *
     * @param ags number of agents.
     */
     void SetAgents(int);
 
+    /** Set a directory for caching the distances of agents.
+    *
+    * Distances computed by SetAgents are stored in a binary file named by a hash of the map and the endpoints of all agents. Later runs on the same instance read the file instead of running BFS.
+    * The file has a versioned header, files of another version are ignored and overwritten. Runs sharing the directory lock the file by flock while storing.
+    *
+    * @param cache_dir existing directory for the cache files. Default is "", ie. no cache.
+    */
+    void SetDistanceCache(std::string);
+
+    /** Set the number of threads computing the distances of agents.
+    *
+    * Searches from up to 64 starts or goals are run together, the batches are split among the threads.
+    *
+    * @param threads number of worker threads. Default is 1.
+    */
+    void SetThreads(int);
+
+    /** Compute distances of agents only when they are first needed.
+    *
+    * SetAgents computes only the shortest path lengths, the distances of an agent are computed on the first call of FirstTimestep or LastTimestep for the agent. Lazily computed distances are not stored into the distance cache.
+    * On maps with 0xFFFF or more vertices a distance may not fit into 16 bits, the distances are computed by SetAgents there, so the overflow is found before solving.
+    *
+    * @param lazy true to compute the distances lazily. Default is false.
+    */
+    void SetLazyDistances(bool);
+
 	/** Set locations to be avoided.
     *
     * Stores the provided argument.
@@ -78,26 +132,50 @@ public:
 	int GetMksLB(size_t);
 	int GetSocLB(size_t);
 
+	/** Makespan lower bound raised by cardinal conflicts.
+    *
+    * Layers of the decision diagrams of the agents for the makespan are built from their distances. If two agents are forced into the same vertex, to swap or, with pebble motion, one of them is forced into the vertex the other one leaves at the same time, the makespan is increased and the check is repeated.
+    *
+    * @param ags number of agents, they have to be set.
+    * @param movement 1 = parallel, 2 = pebble.
+    * @return lower bound on the makespan, at least GetMksLB.
+    */
+	int GetConflictMksLB(size_t, int);
+
+	/** Sum of costs lower bound raised by cardinal conflicts.
+    *
+    * Each agent follows the decision diagram of its shortest paths and stays at its goal afterwards, so a goal lying on all shortest paths of another agent is a conflict as well. A pair of agents in a cardinal conflict costs at least one more, disjoint pairs are added up.
+    *
+    * @param ags number of agents, they have to be set.
+    * @param movement 1 = parallel, 2 = pebble.
+    * @return lower bound on the sum of costs, at least GetSocLB.
+    */
+	int GetConflictSocLB(size_t, int);
+
 	_MAPFSAT_Vertex IDtoCoords(int);
 	bool HasNeighbor(_MAPFSAT_Vertex, int);
 	bool HasNeighbor(int, int);
-	int GetNeighbor(int, int);
+	int GetNeighbor(int, int);	// -1 if the neighbor does not exist
 	
 	int FirstTimestep(int, int);
 	int LastTimestep(int, int, int, int, int);
 	int OppositeDir(int);
+	std::vector<int> ShortestPath(int);	// vertices of a shortest path of the agent from its start to its goal, empty if the goal is not reachable
 
 	void DebugPrint(std::vector<std::vector<int> >&);
 	void DebugPrint(std::vector<int>&);
 	void DebugPrint(std::vector<_MAPFSAT_Vertex>&);
 
 	std::vector<_MAPFSAT_Agent> agents;
-	std::vector<std::vector<int> > length_from_start;
-	std::vector<std::vector<int> > length_from_goal;
+	std::vector<std::vector<uint16_t> > distances;	// distances[a][v] from the start of a, distances[a][number_of_vertices + v] from its goal
 	std::vector<int> SP_lengths;
 	std::vector<_MAPFSAT_Avoid> avoid_locations;
 
-	std::vector<std::vector<int> > map;
+	_MAPFSAT_Grid map;
+	std::vector<int> neighbors;					// neighbors[5 * v + dir] is the neighbor of v in direction dir or -1
+	std::vector<unsigned char> neighbor_mask;	// bit dir is set if v has a neighbor in direction dir
+	std::vector<std::vector<int> > corridors;	// maximal chains of vertices with exactly two neighbors, cells in the order along the chain
+	std::vector<int> corridor_of;				// index of the corridor containing v or -1
 	size_t height;
 	size_t width;
 	size_t number_of_vertices;
@@ -106,17 +184,51 @@ public:
 	std::string map_name;
 
 private:
-	void LoadAgents(std::string, std::string);
+	explicit _MAPFSAT_Instance(std::string);	// map only, for _MAPFSAT_MapCache
+	void CopyMap(const _MAPFSAT_Instance&);
+	void LoadAgents(std::string, std::string, _MAPFSAT_MapCache*);
 	void LoadAgentsData(std::vector<std::pair<int,int> >&, std::vector<std::pair<int,int> >&);
 	void LoadMap(std::string);
 	void LoadMapData(std::vector<std::vector<int> >&);
-	void BFS(std::vector<int>&, _MAPFSAT_Vertex);
+	void CreateNeighbors();
+	void CreateCorridors();
+	void ComputeDistances(size_t, size_t);
+	void ComputeAgentDistances(int);
+	bool BFS(const int*, uint16_t**, size_t);
+	int ShortestPathLength(int);
+	int Distance(int, size_t);
+	void SingleLayers(int, int, int, std::vector<int>&);
+	void CardinalConflicts(size_t, int, int, std::vector<std::pair<int,int> >&);
+	std::string DistanceCacheFile();
+	size_t LoadDistanceCache(size_t, size_t);
+	void StoreDistanceCache(size_t);
 	
 	std::vector<int> mks_LBs;
 	std::vector<int> soc_LBs;
 	std::vector<_MAPFSAT_Vertex> coord_list;
 
 	size_t last_number_of_agents;
+	std::string distance_cache_dir;
+	int threads;
+	bool lazy_distances;
+	std::unique_ptr<std::once_flag[]> distances_computed;
+};
+
+// maps shared by instances loaded from files, the key is the path of the map file
+struct _MAPFSAT_MapCache
+{
+	std::map<std::string, std::unique_ptr<_MAPFSAT_Instance> > maps;
+	std::mutex lock;
 };
 
+inline bool _MAPFSAT_Instance::HasNeighbor(int v, int dir)
+{
+	return (neighbor_mask[v] >> dir) & 1;
+}
+
+inline int _MAPFSAT_Instance::GetNeighbor(int v, int dir)
+{
+	return neighbors[5 * v + dir];
+}
+
 #endif
@@ -2,6 +2,8 @@
 
 using namespace std;
 
+static mutex print_mutex;	// loggers of jobs solved at once share stdout and the log file
+
 /****************************/
 // MARK: constructor
 /****************************/
@@ -25,6 +27,8 @@ void _MAPFSAT_Logger::PrintStatistics()
 	if (print_type == 0) // no print
 		return;
 
+	lock_guard<mutex> guard(print_mutex);
+
 	string solution = "unsat";
 	if (res == 0)
 		solution = "sat";
@@ -55,6 +59,8 @@ void _MAPFSAT_Logger::PrintStatistics()
 			agents << sep <<
 			mksLB << sep <<
 			socLB << sep <<
+			conflict_mksLB << sep <<
+			conflict_socLB << sep <<
 			solution_mks << sep <<
 			solution_soc << sep <<
 			building_time << sep <<
@@ -68,6 +74,7 @@ void _MAPFSAT_Logger::PrintStatistics()
 			nr_clauses_soc << sep <<
 			nr_clauses_unit << sep <<
 			solution << sep <<
+			portfolio_winners << sep <<
 			endl;
 	}
 
@@ -82,6 +89,8 @@ void _MAPFSAT_Logger::PrintStatistics()
 			"Number of agents:     " << agents << sep <<
 			"Mks lower bound:      " << mksLB << sep <<
 			"Soc lower bound:      " << socLB << sep <<
+			"Mks conflict bound:   " << conflict_mksLB << sep <<
+			"Soc conflict bound:   " << conflict_socLB << sep <<
 			"Solution mks:         " << solution_mks << sep <<
 			"Solution soc:         " << solution_soc << sep <<
 			"CNF building time:    " << building_time << sep <<
@@ -95,6 +104,7 @@ void _MAPFSAT_Logger::PrintStatistics()
 			"Nr of soc clauses:    " << nr_clauses_soc << sep <<
 			"Nr of unit clauses:   " << nr_clauses_unit << sep <<
 			"Found solution:       " << solution << sep <<
+			"Portfolio winners:    " << portfolio_winners << sep <<
 			endl << endl;
 	}
 
@@ -111,6 +121,9 @@ void _MAPFSAT_Logger::NewInstance(int ags)
 	agents = ags;
 	mksLB = inst->GetMksLB(ags);
 	socLB = inst->GetSocLB(ags);
+	conflict_mksLB = mksLB;
+	conflict_socLB = socLB;
+	portfolio_winners = "-";
 	solution_mks = 0;
 	solution_soc = 0;
 	building_time = 0;
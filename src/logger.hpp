@@ -48,7 +48,10 @@ public:
 	int solver_calls;
 	int agents;
 	int mksLB;
-	int socLB;	
+	int socLB;
+	int conflict_mksLB;	// raised by cardinal conflicts, equal to mksLB if not computed
+	int conflict_socLB;	// raised by cardinal conflicts, equal to socLB if not computed
+	std::string portfolio_winners;	// encoding answering each call of a portfolio, - without portfolio
 	int res;
 	
 private:
@@ -1,5 +1,8 @@
 #include <stdlib.h>
 #include <unistd.h>
+#include <atomic>
+#include <functional>
+#include <thread>
 
 #include "instance.hpp"
 #include "logger.hpp"
@@ -11,6 +14,7 @@ void PrintIntro(bool);
 void PrintHelp(char**, bool);
 void CleanUp(_MAPFSAT_Instance*, _MAPFSAT_Logger*, _MAPFSAT_ISolver*);
 _MAPFSAT_ISolver* PickEncoding(string);
+int SolveBatch(string, int, int, string, int, bool, bool, function<void(_MAPFSAT_Instance*)>, function<void(_MAPFSAT_ISolver*)>);
 
 int main(int argc, char** argv) 
 {
@@ -23,6 +27,11 @@ int main(int argc, char** argv)
 	bool qflag = false;
 	bool pflag = false;
 	bool oflag = false;
+	bool zflag = false;
+	bool xflag = false;
+	bool wflag = false;
+	bool nflag = false;
+	bool yflag = false;
 	char *evalue = NULL;
 	char *svalue = NULL;
 	char *mvalue = NULL;
@@ -33,21 +42,35 @@ int main(int argc, char** argv)
 	char *fvalue = NULL;
 	char *lvalue = NULL;
 	char *cvalue = NULL;
+	char *kvalue = NULL;
+	char *jvalue = NULL;
+	char *vvalue = NULL;
+	char *bvalue = NULL;
+	char *rvalue = NULL;
+	char *gvalue = NULL;
+	char *uvalue = NULL;
+	char *Svalue = NULL;
+	char *Uvalue = NULL;
+	char *Pvalue = NULL;
 
 	int timeout = 300;
 	string map_dir = "instances/maps";
 	string stat_file = "";
 	string cnf_file = "";
 	int log_option = 0;
+	int window = 0;
+	int threads = 1;
+	int vertex_amo = 0;
+	int delta_search = 0;
 
 	_MAPFSAT_Instance* inst;
 	_MAPFSAT_Logger* log;
-	_MAPFSAT_ISolver* solver;
+	_MAPFSAT_ISolver* solver = NULL;
 
 	// parse arguments
 	opterr = 0;
 	char c;
-	while ((c = getopt (argc, argv, "hqpoe:s:m:a:i:t:d:f:l:c:")) != -1)
+	while ((c = getopt (argc, argv, "hqpozxwnye:s:m:a:i:t:d:f:l:c:k:j:v:b:r:g:u:S:U:P:")) != -1)
 	{
 		switch (c)
 		{
@@ -63,6 +86,21 @@ int main(int argc, char** argv)
 			case 'o':
 				oflag = true;
 				break;
+			case 'z':
+				zflag = true;
+				break;
+			case 'x':
+				xflag = true;
+				break;
+			case 'w':
+				wflag = true;
+				break;
+			case 'n':
+				nflag = true;
+				break;
+			case 'y':
+				yflag = true;
+				break;
 			case 'e':
 				evalue = optarg;
 				break;
@@ -93,8 +131,38 @@ int main(int argc, char** argv)
 			case 'c':
 				cvalue = optarg;
 				break;
+			case 'k':
+				kvalue = optarg;
+				break;
+			case 'j':
+				jvalue = optarg;
+				break;
+			case 'v':
+				vvalue = optarg;
+				break;
+			case 'b':
+				bvalue = optarg;
+				break;
+			case 'r':
+				rvalue = optarg;
+				break;
+			case 'g':
+				gvalue = optarg;
+				break;
+			case 'u':
+				uvalue = optarg;
+				break;
+			case 'S':
+				Svalue = optarg;
+				break;
+			case 'U':
+				Uvalue = optarg;
+				break;
+			case 'P':
+				Pvalue = optarg;
+				break;
 			case '?':
-				if (optopt == 'e' || optopt == 's' || optopt == 'm' || optopt == 'a' || optopt == 'i' || optopt == 't' || optopt == 'd' || optopt == 'f' || optopt == 'l' || optopt == 'c')
+				if (optopt == 'e' || optopt == 's' || optopt == 'm' || optopt == 'a' || optopt == 'i' || optopt == 't' || optopt == 'd' || optopt == 'f' || optopt == 'l' || optopt == 'c' || optopt == 'k' || optopt == 'j' || optopt == 'v' || optopt == 'b' || optopt == 'r' || optopt == 'g' || optopt == 'u' || optopt == 'S' || optopt == 'U' || optopt == 'P')
 				{
 					cout << "Option -" << (char)optopt << " requires an argument!" << endl;
 					return -1;
@@ -118,14 +186,21 @@ int main(int argc, char** argv)
 		return 0;
 	}
 
-	if (evalue == NULL || svalue == NULL)
+	if (rvalue != NULL)	// solve a stored formula, no instance is needed
+	{
+		if (tvalue != NULL)
+			timeout = atoi(tvalue);
+		return (_MAPFSAT_SAT::ReplayFormula(string(rvalue), timeout, qflag) == -1) ? -1 : 0;
+	}
+
+	if (uvalue == NULL && (evalue == NULL || svalue == NULL))
 	{
 		cerr << "Missing a required argument!" << endl;
 		PrintHelp(argv, qflag);
 		return -1;
 	}
 
-	if ((solver = PickEncoding(string(evalue))) == NULL)
+	if (uvalue == NULL && (solver = PickEncoding(string(evalue))) == NULL)
 	{
 		cerr << "Unknown encoding \"" << evalue << "\"!" << endl;
 		PrintHelp(argv, qflag);
@@ -153,10 +228,116 @@ int main(int argc, char** argv)
 	if (cvalue != NULL)
 		cnf_file = cvalue;
 
+	if (kvalue != NULL)
+		window = atoi(kvalue);
+	if (window < 0)
+	{
+		cerr << "Invalid incremental window!" << endl;
+		PrintHelp(argv, qflag);
+		return -1;
+	}
+
+	if (jvalue != NULL)
+		threads = atoi(jvalue);
+	if (threads < 1)
+	{
+		cerr << "Invalid number of threads!" << endl;
+		PrintHelp(argv, qflag);
+		return -1;
+	}
+
+	if (vvalue != NULL)
+	{
+		string amo = vvalue;
+		if (amo == "pairwise")
+			vertex_amo = 0;
+		else if (amo == "sequential")
+			vertex_amo = 1;
+		else if (amo == "commander")
+			vertex_amo = 2;
+		else if (amo == "product")
+			vertex_amo = 3;
+		else
+		{
+			cerr << "Invalid vertex conflict encoding!" << endl;
+			PrintHelp(argv, qflag);
+			return -1;
+		}
+	}
+
+	if (Svalue != NULL)
+	{
+		string search = Svalue;
+		if (search == "linear")
+			delta_search = 0;
+		else if (search == "galloping")
+			delta_search = 1;
+		else
+		{
+			cerr << "Invalid delta search!" << endl;
+			PrintHelp(argv, qflag);
+			return -1;
+		}
+	}
+
+	auto setup_instance = [&](_MAPFSAT_Instance* instance)
+	{
+		if (gvalue != NULL)
+			instance->SetDistanceCache(string(gvalue));
+		instance->SetThreads(threads);
+		instance->SetLazyDistances(zflag);
+	};
+	auto setup_solver = [&](_MAPFSAT_ISolver* new_solver)
+	{
+		new_solver->SetIncremental(window);
+		new_solver->SetVertexAMO(vertex_amo);
+		new_solver->SetMDD(xflag);
+		new_solver->SetCorridors(wflag);
+		new_solver->SetIndependenceDetection(nflag);
+		new_solver->SetConflictBounds(yflag);
+		new_solver->SetDeltaSearch(delta_search);
+	};
+
+	if (uvalue != NULL)	// jobs of the batch file, one thread each
+		return SolveBatch(string(uvalue), threads, log_option, stat_file, (dvalue != NULL) ? atoi(dvalue) : 0, oflag, qflag, setup_instance, setup_solver);
+
 	// create classes and load map
 	inst = new _MAPFSAT_Instance(map_dir, svalue);
+	setup_instance(inst);
 	log = new _MAPFSAT_Logger(inst, evalue, log_option, stat_file);
 	solver->SetData(inst, log, timeout, cnf_file, qflag, pflag);
+	solver->SetThreads(threads);
+	setup_solver(solver);
+	if (Uvalue != NULL)
+		solver->SetDeltaSearch(delta_search, atoi(Uvalue));
+
+	if (Pvalue != NULL)
+	{
+		// other encodings of the portfolio, CaDiCaL only, with the cost function and motion of -e
+		string main_enc = evalue;
+		string same_problem = main_enc.substr(0, main_enc.find('_', main_enc.find('_') + 1) + 1);
+		vector<_MAPFSAT_ISolver*> portfolio;
+		stringstream ssenc(Pvalue);
+		string enc;
+		while (getline(ssenc, enc, ','))
+		{
+			_MAPFSAT_ISolver* portfolio_solver = PickEncoding(enc);
+			if (portfolio_solver == NULL || enc.find("monosat") != string::npos || main_enc.find("monosat") != string::npos || enc.compare(0, same_problem.size(), same_problem) != 0)
+			{
+				cerr << "Invalid portfolio encoding \"" << enc << "\"!" << endl;
+				if (portfolio_solver != NULL)
+					delete portfolio_solver;
+				for (size_t i = 0; i < portfolio.size(); i++)
+					delete portfolio[i];
+				CleanUp(inst, log, solver);
+				return -1;
+			}
+			portfolio.push_back(portfolio_solver);
+		}
+		solver->SetPortfolio(portfolio);
+	}
+	if (bvalue != NULL)
+		solver->SetBinaryFile(string(bvalue));
 
 	// check number of agents and increment
 	size_t current_agents = inst->agents.size();
@@ -185,7 +366,16 @@ int main(int argc, char** argv)
 
 	do 
 	{
-		inst->SetAgents(current_agents);
+		try
+		{
+			inst->SetAgents(current_agents);
+		}
+		catch (const runtime_error& e)
+		{
+			cerr << e.what() << endl;
+			CleanUp(inst, log, solver);
+			return -1;
+		}
 		log->NewInstance(current_agents);
 
 		int res = solver->Solve(current_agents, delta, oflag);
@@ -225,7 +415,7 @@ void PrintIntro(bool quiet)
 	cout << "*******************************************************" << endl;
 	cout << "*        This is a reduction-based MAPF solver        *" << endl;
 	cout << "*          Created by Jiri Svancara @ MFF UK          *" << endl;
-	cout << "*       Used SAT solvers are CaDiCaL and Monosat      *" << endl;
+	cout << "*   Used SAT solvers are CaDiCaL, Kissat and Monosat  *" << endl;
 	cout << "*******************************************************" << endl;
 	cout << endl;
 }
@@ -241,11 +431,11 @@ void PrintHelp(char* argv[], bool quiet)
 
 	cout << endl;
 	cout << "Usage of this program:" << endl;
-	cout << argv[0] << " [-h] [-q] [-p] -e encoding -s scenario_file [-m map_dir] [-a number_of_agents] [-i increment] [-t timeout] [-d delta] [-o] [-f log_file]" << endl;
+	cout << argv[0] << " [-h] [-q] [-p] -e encoding -s scenario_file [-m map_dir] [-a number_of_agents] [-i increment] [-t timeout] [-d delta] [-o] [-f log_file] [-l log_level] [-c cnf_file] [-k window] [-j threads] [-v vertex_amo] [-b binary_file] [-r binary_file] [-g cache_dir] [-z] [-x] [-w] [-n] [-y] [-u batch_file] [-S delta_search] [-U upper_bound] [-P encodings]" << endl;
 	cout << "	-h                  : Prints help and exits" << endl;
 	cout << "	-q                  : Suppress print on stdout" << endl;
 	cout << "	-p                  : Print found plan. If q flag is set, p flag is overwritten." << endl;
-	cout << "	-e encoding         : Encoding to be used. Available options are {mks|soc}_{parallel|pebble}_{at|pass|shift|monosat-pass|monosat-shift}_{eager|lazy}_{single|dupli}" << endl;
+	cout << "	-e encoding         : Encoding to be used. Available options are {mks|soc}_{parallel|pebble}_{at|pass|shift|monosat-pass|monosat-shift|kissat-at|kissat-pass|kissat-shift}_{eager|lazy}_{single|dupli}, kissat only with eager" << endl;
 	cout << "	-s scenario_file    : Path to a scenario file" << endl;
 	cout << "	-m map_dir          : Directory containing map files. Default is instances/maps" << endl;
 	cout << "	-a number_of_agents : Number of agents to solve. If not specified, all agents in the scenario file are used." << endl;
@@ -255,7 +445,22 @@ void PrintHelp(char* argv[], bool quiet)
 	cout << "	-o                  : Oneshot solving. Ie. do not increment cost in case of unsat call. Default is to optimize." << endl;
 	cout << "	-f log_file         : log file. If not specified, output to stdout." << endl;
 	cout << "	-l log_level        : logging option. 0 = no log, 1 = inline log, 2 = human readable log. if -f log_file is not specified in combination with -l 1 or -l 2 overrides -q. Default is 0." << endl;
-	cout << "	-c cnf_file         : print the created CNF into cnf_file. If not specified, the created CNF is not printed." << endl;
+	cout << "	-c cnf_file         : print the created CNF into cnf_file while it is built, the file holds the last solved formula. If not specified, the created CNF is not printed." << endl;
+	cout << "	-k window           : Keep one solver for window delta increments. Only for CaDiCaL. Default is 0, ie. build a new formula for each delta." << endl;
+	cout << "	-j threads          : Number of threads used to compute distances of agents and to build the formula. Default is 1." << endl;
+	cout << "	-v vertex_amo       : Encoding of eager vertex conflicts - pairwise, sequential, commander or product. Default is pairwise." << endl;
+	cout << "	-b binary_file      : store the solved formula and solver calls into binary_file in a compact binary form. Only for CaDiCaL." << endl;
+	cout << "	-r binary_file      : solve the formula stored in binary_file by -b using CaDiCaL, print the times and exit. Other options except -t and -q are ignored." << endl;
+	cout << "	-g cache_dir        : store the distances of agents into cache_dir and reuse them in later runs on the same map and scenario. The directory has to exist." << endl;
+	cout << "	-z                  : Compute distances of agents only when the encoding first uses them. Lazily computed distances are not cached by -g." << endl;
+	cout << "	-x                  : Prune the time expanded graph by a decision diagram of each agent before creating variables. Only for CaDiCaL and Kissat." << endl;
+	cout << "	-w                  : Encode swapping conflicts inside corridors of the map by direction variables of their edges. Only for CaDiCaL and Kissat with parallel motion and at or pass variables." << endl;
+	cout << "	-n                  : Independence detection. Agents start on shortest paths, groups of conflicting agents are merged and solved by separate solvers on the threads given by -j. A replanned group avoids the vertices of the other paths but not swaps with them, such swaps are found and resolved in the next round. Not used with -o, -d is ignored." << endl;
+	cout << "	-y                  : Start from lower bounds raised by cardinal conflicts between pairs of agents and by goals on shortest paths of other agents. Both bounds are logged next to the trivial ones. Not used with -o, -d is used if it is higher." << endl;
+	cout << "	-u batch_file       : Solve the jobs listed in batch_file, one job per line as map_dir scenario_file number_of_agents encoding timeout, 0 agents means all agents. Jobs run at once on the threads given by -j and share loaded maps and distances of agents, each job and its distances use a single thread. The results are logged as given by -l and -f. Options -e, -s, -m, -a, -i, -t, -c, -b, -p, -U and -P are not used." << endl;
+	cout << "	-S delta_search     : Search of the delta after an unsat call - linear or galloping. Linear adds one to delta, galloping adds 1, 2, 4, ... until a sat call and then halves the interval between the unsat and sat delta. Galloping is not used with -o and -k. A timeout after a sat call is still reported as a timeout, the lowest sat delta is printed as an upper bound. Default is linear." << endl;
+	cout << "	-U upper_bound      : Makespan or sum of costs of a known solution of the first call, galloping search starts between the lower bound and upper_bound." << endl;
+	cout << "	-P encodings        : Portfolio of encodings separated by commas. They solve each delta in parallel with the encoding given by -e, the first answer is used and the others are cancelled. The winning encodings are logged. Only CaDiCaL and Kissat encodings with the cost function and motion of -e." << endl;
 	cout << endl;
 }
 
@@ -321,6 +526,21 @@ _MAPFSAT_ISolver* PickEncoding(string enc)
 		var = 3;
 		satsolver = 2;
 	}
+	if (parsed_options[2].compare("kissat-at") == 0)
+	{
+		var = 1;
+		satsolver = 3;
+	}
+	if (parsed_options[2].compare("kissat-pass") == 0)
+	{
+		var = 2;
+		satsolver = 3;
+	}
+	if (parsed_options[2].compare("kissat-shift") == 0)
+	{
+		var = 3;
+		satsolver = 3;
+	}
 	if (var < 0)
 		return NULL;
 
@@ -329,7 +549,7 @@ _MAPFSAT_ISolver* PickEncoding(string enc)
 		lazy = 1;
 	if (parsed_options[3].compare("lazy") == 0)
 		lazy = 2;
-	if (lazy < 0)
+	if (lazy < 0 || (lazy == 2 && satsolver == 3))	// Kissat solves a formula only once
 		return NULL;
 
 	// duplicate agents
@@ -344,6 +564,160 @@ _MAPFSAT_ISolver* PickEncoding(string enc)
 		solver = new _MAPFSAT_SAT(var,cost,moves,lazy,dupli,satsolver,enc);
 	if (satsolver == 2) 
 		solver = new _MAPFSAT_SMT(var,cost,moves,lazy,dupli,satsolver,enc);
+	if (satsolver == 3)
+		solver = new _MAPFSAT_Kissat(var,cost,moves,lazy,dupli,satsolver,enc);
 
 	return solver;
+}
+/****************************/
+// MARK: batch
+/****************************/
+
+struct BatchJob
+{
+	string map_dir;
+	string scenario;
+	size_t agents;		// 0 = all agents
+	string encoding;
+	int timeout;
+};
+
+struct BatchScenario
+{
+	unique_ptr<_MAPFSAT_Instance> inst;	// loaded by the first job, released after the last one
+	size_t agents = 0;					// distances are computed for the most agents of its jobs
+	int remaining = 0;					// jobs that did not take their agents yet
+	mutex lock;
+};
+
+int SolveBatch(string batch_file, int workers, int log_option, string stat_file, int delta, bool oneshot, bool quiet,
+				function<void(_MAPFSAT_Instance*)> setup_instance, function<void(_MAPFSAT_ISolver*)> setup_solver)
+{
+	ifstream in(batch_file);
+	if (!in.is_open())
+	{
+		cerr << "Could not open batch file " << batch_file << endl;
+		return -1;
+	}
+
+	// map_dir scenario_file number_of_agents encoding timeout, empty lines and lines starting with # are skipped
+	vector<BatchJob> jobs;
+	map<pair<string,string>, BatchScenario> scenarios;
+	string line;
+	for (int line_nr = 1; getline(in, line); line_nr++)
+	{
+		stringstream ssline(line);
+		BatchJob job;
+		if (!(ssline >> job.map_dir) || job.map_dir[0] == '#')
+			continue;
+		long long agents = -1;
+		if (!(ssline >> job.scenario >> agents >> job.encoding >> job.timeout) || agents < 0 || job.timeout <= 0)
+		{
+			cerr << "Invalid job on line " << line_nr << " of batch file " << batch_file << "!" << endl;
+			return -1;
+		}
+		_MAPFSAT_ISolver* check = PickEncoding(job.encoding);
+		if (check == NULL)
+		{
+			cerr << "Unknown encoding \"" << job.encoding << "\" on line " << line_nr << " of batch file " << batch_file << "!" << endl;
+			return -1;
+		}
+		delete check;
+
+		job.agents = size_t(agents);
+		BatchScenario& scenario = scenarios[make_pair(job.map_dir, job.scenario)];
+		scenario.agents = (job.agents == 0 || scenario.agents == SIZE_MAX) ? SIZE_MAX : max(scenario.agents, job.agents);
+		scenario.remaining++;
+		jobs.push_back(job);
+	}
+
+	_MAPFSAT_MapCache map_cache;
+	atomic<size_t> next_job(0);
+	mutex print_mutex;
+	mutex monosat_mutex;	// monosat is called through shared files
+
+	auto worker = [&]()
+	{
+		for (size_t j = next_job++; j < jobs.size(); j = next_job++)
+		{
+			BatchJob& job = jobs[j];
+			BatchScenario& scenario = scenarios.find(make_pair(job.map_dir, job.scenario))->second;
+
+			// the instance of the job gets the map and distances of the first agents of the shared scenario instance
+			unique_ptr<_MAPFSAT_Instance> inst;
+			size_t agents = job.agents;
+			{
+				lock_guard<mutex> guard(scenario.lock);
+				if (!scenario.inst)
+				{
+					scenario.inst.reset(new _MAPFSAT_Instance(job.map_dir, job.scenario, &map_cache));
+					setup_instance(scenario.inst.get());
+					scenario.inst->SetThreads(1);	// the -j threads already run jobs
+					try
+					{
+						scenario.inst->SetAgents(min(scenario.agents, scenario.inst->agents.size()));
+					}
+					catch (const runtime_error& e)
+					{
+						scenario.inst.reset();
+						--scenario.remaining;
+						lock_guard<mutex> print_guard(print_mutex);
+						cerr << job.scenario << ": " << e.what() << endl;
+						continue;
+					}
+				}
+				if (agents == 0)
+					agents = scenario.inst->agents.size();
+				if (agents > 0 && agents <= scenario.inst->agents.size())
+				{
+					vector<int> group(agents);
+					for (size_t a = 0; a < agents; a++)
+						group[a] = a;
+					inst.reset(new _MAPFSAT_Instance(*scenario.inst, group));
+				}
+				if (--scenario.remaining == 0)
+					scenario.inst.reset();
+			}
+
+			if (!inst)
+			{
+				lock_guard<mutex> guard(print_mutex);
+				cerr << "Invalid number of agents " << agents << " for the " << job.scenario << " scenario file." << endl;
+				continue;
+			}
+
+			_MAPFSAT_Logger log(inst.get(), job.encoding, log_option, stat_file);
+			unique_ptr<_MAPFSAT_ISolver> solver(PickEncoding(job.encoding));
+			solver->SetData(inst.get(), &log, job.timeout, "", true, false);
+			solver->SetThreads(1);
+			setup_solver(solver.get());
+
+			log.NewInstance(agents);
+			int res;
+			if (job.encoding.find("monosat") != string::npos)
+			{
+				lock_guard<mutex> guard(monosat_mutex);
+				res = solver->Solve(agents, delta, oneshot);
+			}
+			else
+				res = solver->Solve(agents, delta, oneshot);
+
+			if (res != 1)
+				log.PrintStatistics();
+			if (!quiet && res != 0)
+			{
+				lock_guard<mutex> guard(print_mutex);
+				cout << job.scenario << " " << job.encoding << " " << agents << " agents: " << ((res == 1) ? "No solution found in the given timeout" : "No solution found in the given cost limit") << endl;
+			}
+		}
+	};
+
+	vector<thread> pool;
+	for (int i = 1; i < min(workers, (int)jobs.size()); i++)
+		pool.push_back(thread(worker));
+	worker();
+	for (size_t i = 0; i < pool.size(); i++)
+		pool[i].join();
+
+	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,91 @@
+#include <cstdlib>
+#include <iostream>
+
+#include "../src/encodings/solver_common.hpp"
+
+using namespace std;
+
+// compares FindConflicts with the pairwise scan over agents and timesteps it replaced
+class _MAPFSAT_ConflictTest : public _MAPFSAT_SAT
+{
+public:
+	_MAPFSAT_ConflictTest(_MAPFSAT_Instance* instance, int moves) : _MAPFSAT_SAT(1, 1, moves, 2, 1)
+	{
+		inst = instance;
+	}
+
+	bool Compare(vector<vector<int> >& new_plan)
+	{
+		plan = new_plan;
+
+		vector<tuple<int,int,int,int> > vertex_found, vertex_scan;
+		vector<tuple<int,int,int,int,int> > swap_found, swap_scan;
+		vector<tuple<int,int,int,int,int> > pebble_found, pebble_scan;
+		bool found = FindConflicts(vertex_found, swap_found, pebble_found);
+		Scan(vertex_scan, swap_scan, pebble_scan);
+
+		bool any = !vertex_scan.empty() || !swap_scan.empty() || !pebble_scan.empty();
+		return found == any && vertex_found == vertex_scan && swap_found == swap_scan && pebble_found == pebble_scan;
+	}
+
+private:
+	// the old scan of GenerateConflicts
+	void Scan(vector<tuple<int,int,int,int> >& vertex_scan, vector<tuple<int,int,int,int,int> >& swap_scan, vector<tuple<int,int,int,int,int> >& pebble_scan)
+	{
+		for (int a1 = 0; a1 < (int)plan.size(); a1++)
+		{
+			for (int a2 = a1+1; a2 < (int)plan.size(); a2++)
+			{
+				for (int t = 0; t < (int)plan[a1].size(); t++)
+				{
+					bool next = t < (int)plan[a1].size() - 1;
+					if (plan[a1][t] == plan[a2][t])
+						vertex_scan.push_back(make_tuple(a1,a2,plan[a1][t],t));
+					if (next && plan[a1][t] == plan[a2][t+1] && plan[a1][t+1] == plan[a2][t] && plan[a1][t] != plan[a2][t])
+						swap_scan.push_back(make_tuple(a1,a2,plan[a1][t],plan[a1][t+1],t));
+					if (movement == 2 && next && plan[a1][t] == plan[a2][t+1] && plan[a2][t] != plan[a2][t+1])
+						pebble_scan.push_back(make_tuple(a2,a1,plan[a2][t],plan[a2][t+1],t+1));
+					if (movement == 2 && next && plan[a1][t+1] == plan[a2][t] && plan[a1][t] != plan[a1][t+1])
+						pebble_scan.push_back(make_tuple(a1,a2,plan[a1][t],plan[a1][t+1],t+1));
+				}
+			}
+		}
+	}
+};
+
+int main()
+{
+	// 3x4 grid without obstacles, plans are random walks over its 12 vertices and -1
+	vector<vector<int> > map(3, vector<int>(4, 1));
+	vector<pair<int,int> > start = {{0,0}};
+	vector<pair<int,int> > goal = {{2,3}};
+	_MAPFSAT_Instance inst(map, start, goal);
+
+	srand(1);
+	int failed = 0;
+	for (int moves = 1; moves <= 2; moves++)
+	{
+		_MAPFSAT_ConflictTest solver(&inst, moves);	// one solver for all plans, the tables are reused
+		for (int i = 0; i < 5000; i++)
+		{
+			int agents = 1 + rand() % 8;
+			int timesteps = 1 + rand() % 10;
+			int missing = rand() % 4;	// percentage of -1 positions is 0, 10, 20 or 30
+			vector<vector<int> > plan(agents, vector<int>(timesteps));
+			for (int a = 0; a < agents; a++)
+			{
+				for (int t = 0; t < timesteps; t++)
+					plan[a][t] = (rand() % 10 < missing) ? -1 : rand() % inst.number_of_vertices;
+			}
+
+			if (!solver.Compare(plan))
+			{
+				failed++;
+				cout << "FindConflicts differs from the scan on plan " << i << " with movement " << moves << endl;
+			}
+		}
+	}
+
+	cout << ((failed == 0) ? "FindConflicts matches the scan on all plans" : "FindConflicts test failed") << endl;
+	return (failed == 0) ? 0 : 1;
+}